@@ -0,0 +1,267 @@
+#ifndef _CONCURRENT_LOG_HEADER_H_
+#define _CONCURRENT_LOG_HEADER_H_
+#include "serialize.h"
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <limits>
+#include <stdint.h>
+
+////////////////////////////////////////////////////
+//multi-producer serialization log
+//
+//Every producer thread owns a concurrent_log::writer,
+//which encodes a record straight into a node of its own
+//and publishes the node on an intrusive lock-free MPSC
+//queue (Vyukov).A single consumer drains the queue in
+//batches into one contiguous string, each record framed
+//by a 4 byte length, and hands the nodes back to their
+//writers for reuse.Nothing on the encode path takes a
+//lock or, once warmed up, allocates.
+////////////////////////////////////////////////////
+
+class concurrent_log
+{
+private:
+	struct writer_state;
+
+	struct node
+	{
+		std::atomic<node*> next;
+		writer_state* owner;
+		std::string data;
+
+		node() : next(nullptr), owner(nullptr)
+		{
+		}
+	};
+
+	//消费者把用完的节点压回这里,写者一次全部取走,不存在ABA问题
+	struct writer_state
+	{
+		std::atomic<node*> returned;
+		bool in_use;
+
+		writer_state() : returned(nullptr), in_use(false)
+		{
+		}
+	};
+
+public:
+	class writer
+	{
+	public:
+		explicit writer(concurrent_log& log) : log_(log), state_(log.attach())
+		{
+		}
+
+		writer(const writer&) = delete;
+		writer& operator=(const writer&) = delete;
+
+		~writer()
+		{
+			for (node* n : cache_) {
+				log_.give_back(n);
+			}
+
+			log_.detach(state_);
+		}
+
+		//把items按顺序编码成一条记录并发布
+		//编码抛出异常或记录超过4G时不发布,节点放回缓存
+		template<typename... Types>
+		void emit(Types&... items)
+		{
+			node* n = acquire();
+			os_.swap_buffer(n->data);
+			try {
+				os_.reset();
+				unsigned int len = 0;
+				os_ << len;
+				write_items(items...);
+			}
+			catch (...) {
+				os_.swap_buffer(n->data);
+				cache_.push_back(n);
+				throw;
+			}
+
+			os_.swap_buffer(n->data);
+			size_t size = n->data.size() - sizeof(unsigned int);
+			if (size > 0xffffffffu) {
+				std::string().swap(n->data);
+				cache_.push_back(n);
+				throw std::length_error("concurrent_log: record exceeds 32 bits");
+			}
+
+			unsigned int len = static_cast<unsigned int>(size);
+			memcpy(&n->data[0], &len, sizeof(len));
+			log_.push(n);
+		}
+
+	private:
+		void write_items()
+		{
+		}
+
+		template<typename Type, typename... Types>
+		void write_items(Type& a, Types&... rest)
+		{
+			os_ << a;
+			write_items(rest...);
+		}
+
+		node* acquire()
+		{
+			if (cache_.empty()) {
+				node* n = state_->returned.exchange(nullptr, std::memory_order_acquire);
+				for (; n != nullptr; n = n->next.load(std::memory_order_relaxed)) {
+					cache_.push_back(n);
+				}
+			}
+
+			if (cache_.empty()) {
+				node* n = new node();
+				n->owner = state_;
+				return n;
+			}
+
+			node* n = cache_.back();
+			cache_.pop_back();
+			return n;
+		}
+
+	private:
+		concurrent_log& log_;
+		writer_state* state_;
+		out_stream os_;
+		std::vector<node*> cache_;
+	};
+
+public:
+	concurrent_log() : head_(&stub_), tail_(&stub_)
+	{
+	}
+
+	concurrent_log(const concurrent_log&) = delete;
+	concurrent_log& operator=(const concurrent_log&) = delete;
+
+	//所有writer须先于日志析构
+	~concurrent_log()
+	{
+		for (node* n = pop(); n != nullptr; n = pop()) {
+			delete n;
+		}
+
+		for (auto& state : states_) {
+			node* n = state->returned.exchange(nullptr, std::memory_order_acquire);
+			while (n != nullptr) {
+				node* next = n->next.load(std::memory_order_relaxed);
+				delete n;
+				n = next;
+			}
+		}
+	}
+
+	//只能在一个消费线程中调用
+	//把已发布的记录追加到out末尾,返回取出的记录数
+	size_t drain(std::string& out, size_t max_records = std::numeric_limits<size_t>::max())
+	{
+		size_t count = 0;
+		while (count < max_records) {
+			node* n = pop();
+			if (n == nullptr) {
+				break;
+			}
+
+			out.append(n->data);
+			give_back(n);
+			++count;
+		}
+
+		return count;
+	}
+
+private:
+	writer_state* attach()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		for (auto& state : states_) {
+			if (!state->in_use) {
+				state->in_use = true;
+				return state.get();
+			}
+		}
+
+		states_.emplace_back(new writer_state());
+		states_.back()->in_use = true;
+		return states_.back().get();
+	}
+
+	void detach(writer_state* state)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		state->in_use = false;
+	}
+
+	void give_back(node* n)
+	{
+		writer_state* state = n->owner;
+		node* top = state->returned.load(std::memory_order_relaxed);
+		do {
+			n->next.store(top, std::memory_order_relaxed);
+		} while (!state->returned.compare_exchange_weak(top, n, std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	void push(node* n)
+	{
+		n->next.store(nullptr, std::memory_order_relaxed);
+		node* prev = head_.exchange(n, std::memory_order_acq_rel);
+		prev->next.store(n, std::memory_order_release);
+	}
+
+	//生产者在exchange和链接之间被打断时暂时返回空
+	node* pop()
+	{
+		node* tail = tail_;
+		node* next = tail->next.load(std::memory_order_acquire);
+		if (tail == &stub_) {
+			if (next == nullptr) {
+				return nullptr;
+			}
+
+			tail_ = next;
+			tail = next;
+			next = next->next.load(std::memory_order_acquire);
+		}
+
+		if (next != nullptr) {
+			tail_ = next;
+			return tail;
+		}
+
+		if (tail != head_.load(std::memory_order_acquire)) {
+			return nullptr;
+		}
+
+		push(&stub_);
+		next = tail->next.load(std::memory_order_acquire);
+		if (next != nullptr) {
+			tail_ = next;
+			return tail;
+		}
+
+		return nullptr;
+	}
+
+private:
+	//生产者和消费者各自修改的字段放在不同的cache line
+	node stub_;
+	alignas(64) std::atomic<node*> head_;
+	alignas(64) node* tail_;
+	std::mutex mutex_;
+	std::vector<std::unique_ptr<writer_state> > states_;
+};
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef _DELTA_STREAM_HEADER_H_
+#define _DELTA_STREAM_HEADER_H_
+#include "serialize.h"
+
+////////////////////////////////////////////////////
+//differential serialization for std::map and
+//std::unordered_map
+//
+//A patch holds the upserted entries followed by the
+//erased keys:
+//  count, key0, value0, key1, value1 ...
+//  count, key0, key1 ...
+//Inserts and updates are both sent as upserts, the
+//receiver applies the patch in place with apply_delta.
+//The counts follow the stream's length_mode.
+////////////////////////////////////////////////////
+
+namespace delta {
+
+//记录变更key的集合,与被跟踪的容器同类
+template<typename Map>
+struct change_set
+{
+	typedef std::set<typename Map::key_type, typename Map::key_compare> type;
+};
+
+template<typename Key, typename Value, typename Hash, typename Pred, typename Alloc>
+struct change_set<std::unordered_map<Key, Value, Hash, Pred, Alloc> >
+{
+	typedef std::unordered_set<Key, Hash, Pred> type;
+};
+
+//serialize不会修改参数,这里只是为了匹配非const的接口
+template<typename Type>
+static void write_item(out_stream& os, const Type& a)
+{
+	os << const_cast<Type&>(a);
+}
+
+}//namespace delta
+
+//带变更跟踪的map,写delta的开销只与变更数量有关
+//通过operator[]取得的元素都视为已修改,只读访问请用data()
+template<typename Map>
+class tracked_map
+{
+public:
+	typedef typename Map::key_type key_type;
+	typedef typename Map::mapped_type mapped_type;
+	typedef typename delta::change_set<Map>::type change_set;
+
+	tracked_map() = default;
+	~tracked_map() = default;
+
+	const Map& data() const
+	{
+		return map_;
+	}
+
+	mapped_type& operator[](const key_type& key)
+	{
+		upserted_.insert(key);
+		erased_.erase(key);
+		return map_[key];
+	}
+
+	size_t erase(const key_type& key)
+	{
+		size_t n = map_.erase(key);
+		if (n > 0) {
+			upserted_.erase(key);
+			erased_.insert(key);
+		}
+
+		return n;
+	}
+
+	void clear()
+	{
+		for (const auto& info : map_) {
+			erased_.insert(info.first);
+		}
+
+		upserted_.clear();
+		map_.clear();
+	}
+
+	const change_set& upserted() const
+	{
+		return upserted_;
+	}
+
+	const change_set& erased() const
+	{
+		return erased_;
+	}
+
+	//变更已发送,开始记录下一轮
+	void clear_changes()
+	{
+		upserted_.clear();
+		erased_.clear();
+	}
+
+private:
+	Map map_;
+	change_set upserted_;
+	change_set erased_;
+};
+
+//比较prev和curr,写出把prev变成curr的补丁
+template<typename Map>
+static out_stream& write_delta(out_stream& os, const Map& prev, const Map& curr)
+{
+	std::vector<const typename Map::value_type*> upserted;
+	std::vector<const typename Map::key_type*> erased;
+
+	for (const auto& info : curr) {
+		auto it = prev.find(info.first);
+		if (it == prev.end() || !(it->second == info.second)) {
+			upserted.emplace_back(&info);
+		}
+	}
+
+	for (const auto& info : prev) {
+		if (curr.find(info.first) == curr.end()) {
+			erased.emplace_back(&info.first);
+		}
+	}
+
+	os.write_length(upserted.size());
+	for (const auto* info : upserted) {
+		delta::write_item(os, info->first);
+		delta::write_item(os, info->second);
+	}
+
+	os.write_length(erased.size());
+	for (const auto* key : erased) {
+		delta::write_item(os, *key);
+	}
+
+	return os;
+}
+
+//写出上次clear_changes以来的变更,并清空变更记录
+template<typename Map>
+static out_stream& write_delta(out_stream& os, tracked_map<Map>& a)
+{
+	os.write_length(a.upserted().size());
+	for (const auto& key : a.upserted()) {
+		delta::write_item(os, key);
+		delta::write_item(os, a.data().find(key)->second);
+	}
+
+	os.write_length(a.erased().size());
+	for (const auto& key : a.erased()) {
+		delta::write_item(os, key);
+	}
+
+	a.clear_changes();
+	return os;
+}
+
+//把补丁原位应用到a上
+template<typename Map>
+static in_stream& apply_delta(in_stream& is, Map& a)
+{
+	size_t len = is.read_length();
+	for (size_t i = 0; i < len; ++i) {
+		typename Map::key_type key;
+		typename Map::mapped_type val;
+		is >> key >> val;
+		a[std::move(key)] = std::move(val);
+	}
+
+	len = is.read_length();
+	for (size_t i = 0; i < len; ++i) {
+		typename Map::key_type key;
+		is >> key;
+		a.erase(key);
+	}
+
+	return is;
+}
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef _GATHER_IO_HEADER_H_
+#define _GATHER_IO_HEADER_H_
+#include "serialize.h"
+#include <cstring>
+#include <system_error>
+#include <errno.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////
+//scatter-gather output for out_stream
+//
+//With out_stream::set_reference_threshold, large
+//strings and vectors are referenced instead of copied.
+//These helpers turn the segment list into an iovec
+//array and hand it to writev/sendmsg, retrying after
+//partial writes, so only the small encoded parts are
+//ever copied.
+////////////////////////////////////////////////////
+
+namespace gather {
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+//反复调用io直到全部写完,io返回本次写入的字节数
+template<typename Io>
+static size_t write_all(const out_stream& os, Io io)
+{
+	std::vector<std::pair<const char*, size_t> > segments;
+	os.gather(segments);
+
+	std::vector<struct iovec> iov(segments.size());
+	for (size_t i = 0; i < segments.size(); ++i) {
+		iov[i].iov_base = const_cast<char*>(segments[i].first);
+		iov[i].iov_len = segments[i].second;
+	}
+
+	size_t total = 0;
+	size_t first = 0;
+	while (first < iov.size()) {
+		int count = static_cast<int>(std::min<size_t>(iov.size() - first, IOV_MAX));
+		ssize_t n = io(&iov[first], count);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			throw std::system_error(errno, std::generic_category(), "gather write");
+		}
+
+		total += static_cast<size_t>(n);
+
+		//跳过已写完的段,调整写了一部分的段
+		size_t done = static_cast<size_t>(n);
+		while (first < iov.size() && done >= iov[first].iov_len) {
+			done -= iov[first].iov_len;
+			++first;
+		}
+
+		if (done > 0) {
+			iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + done;
+			iov[first].iov_len -= done;
+		}
+	}
+
+	return total;
+}
+
+}//namespace gather
+
+//用writev写出os的全部数据,返回写入的字节数
+inline size_t gather_write(int fd, const out_stream& os)
+{
+	return gather::write_all(os, [fd](struct iovec* iov, int count) {
+		return ::writev(fd, iov, count);
+	});
+}
+
+//用sendmsg发送os的全部数据,返回发送的字节数
+inline size_t gather_send(int sock, const out_stream& os, int flags = 0)
+{
+	return gather::write_all(os, [sock, flags](struct iovec* iov, int count) {
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = count;
+		return ::sendmsg(sock, &msg, flags);
+	});
+}
+
+#endif
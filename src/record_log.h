@@ -0,0 +1,547 @@
+#ifndef _RECORD_LOG_HEADER_H_
+#define _RECORD_LOG_HEADER_H_
+#include "serialize.h"
+#include <cstring>
+#include <system_error>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////
+//append-only record log
+//
+//file header: magic(4) version(4) last_index(8) committed(8)
+//frame:       length(4) type(1) checksum(4) payload
+//
+//Records are length framed.After every index_interval
+//records an index frame is appended that points to the
+//start of that run of records and to the previous index
+//frame.The file header holds the offset of the newest
+//index frame, so a reopen after a crash walks the index
+//chain and only scans the records after the last index
+//frame.Everything past the committed end recorded in
+//the header is an unsynced tail and is truncated at the
+//first bad frame, a bad frame before it is reported as
+//corruption.A clean close
+//appends a footer with the whole index, which a reopen
+//reads in one go and then cuts off again.
+//
+//Appends are batched in memory and written with one
+//write and one fdatasync per commit (group commit).
+////////////////////////////////////////////////////
+
+class record_log
+{
+public:
+	record_log(const std::string& path, size_t index_interval = 1024, size_t group_bytes = 64 * 1024)
+		: fd_(-1), file_size_(0), count_(0), last_index_(0), synced_index_(0), committed_(0),
+		index_interval_(index_interval), group_bytes_(group_bytes)
+	{
+		if (index_interval_ == 0) {
+			throw std::invalid_argument("record_log: index_interval must be positive");
+		}
+
+		fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+		if (fd_ < 0) {
+			throw std::system_error(errno, std::generic_category(), "open");
+		}
+
+		try {
+			load();
+		}
+		catch (...) {
+			::close(fd_);
+			throw;
+		}
+	}
+
+	record_log(const record_log&) = delete;
+	record_log& operator=(const record_log&) = delete;
+
+	~record_log()
+	{
+		try {
+			close();
+		}
+		catch (...) {
+		}
+	}
+
+	//追加一条记录,返回记录号;数据在commit之后才落盘
+	uint64_t append(const char* data, size_t size)
+	{
+		segment seg(data, size);
+		return append_record(&seg, 1);
+	}
+
+	//引用的数据块按gather列出的各段直接写入同一帧
+	uint64_t append(const out_stream& os)
+	{
+		if (!os.has_references()) {
+			return append(os.buffer().data(), os.buffer().size());
+		}
+
+		std::vector<segment> segments;
+		os.gather(segments);
+		return append_record(segments.data(), segments.size());
+	}
+
+	//写出积攒的记录并fdatasync,之后更新文件头中的索引位置
+	void commit()
+	{
+		flush();
+		if (::fdatasync(fd_) != 0) {
+			throw std::system_error(errno, std::generic_category(), "fdatasync");
+		}
+
+		//文件头在数据落盘之后写,最坏情况下记录的提交位置偏旧,不会超前
+		if (last_index_ != synced_index_ || file_size_ != committed_) {
+			write_header(last_index_, file_size_);
+		}
+	}
+
+	//按记录号读取,先二分查找索引再顺序扫描不超过index_interval条记录
+	bool read(uint64_t record_no, std::string& out)
+	{
+		if (record_no >= count_) {
+			return false;
+		}
+
+		flush();
+		auto it = std::upper_bound(checkpoints_.begin(), checkpoints_.end(), record_no,
+			[](uint64_t n, const checkpoint& c) { return n < c.record_no; });
+		--it;
+
+		uint64_t n = it->record_no;
+		uint64_t offset = it->offset;
+		for (;;) {
+			frame f;
+			if (!read_frame(offset, f, nullptr)) {
+				throw std::runtime_error("record_log: corrupt record");
+			}
+
+			if (f.type == frame_record && n++ == record_no) {
+				if (!read_frame(offset, f, &out)) {
+					throw std::runtime_error("record_log: corrupt record");
+				}
+
+				return true;
+			}
+
+			offset += frame_header_size + f.length;
+		}
+	}
+
+	//记录条数
+	uint64_t size() const
+	{
+		return count_;
+	}
+
+	//提交剩余数据并写入footer
+	void close()
+	{
+		if (fd_ < 0) {
+			return;
+		}
+
+		commit();
+
+		std::vector<std::pair<uint64_t, uint64_t> > index;
+		index.reserve(checkpoints_.size());
+		for (const auto& c : checkpoints_) {
+			index.emplace_back(c.record_no, c.offset);
+		}
+
+		out_stream os;
+		os << last_index_ << count_ << index;
+		uint64_t footer = file_size_;
+		append_frame(frame_footer, os.buffer().data(), os.buffer().size());
+		flush();
+		if (::fdatasync(fd_) != 0) {
+			throw std::system_error(errno, std::generic_category(), "fdatasync");
+		}
+
+		write_header(footer, file_size_);
+		::close(fd_);
+		fd_ = -1;
+	}
+
+private:
+	static const uint32_t magic_value = 0x474f4c52;
+	static const uint32_t version = 2;
+	static const size_t file_header_size = 24;
+	static const size_t frame_header_size = 9;
+	static const uint32_t checksum_seed = 2166136261u;
+
+	enum frame_type
+	{
+		frame_record = 1,
+		frame_index = 2,
+		frame_footer = 3
+	};
+
+	struct frame
+	{
+		uint32_t length;
+		unsigned char type;
+	};
+
+	//一段连续记录的起点
+	struct checkpoint
+	{
+		uint64_t record_no;
+		uint64_t offset;
+	};
+
+	typedef std::pair<const char*, size_t> segment;
+
+	//FNV-1a,hash传入上一段的结果可以分段计算
+	static uint32_t checksum(const char* data, size_t size, uint32_t hash = checksum_seed)
+	{
+		for (size_t i = 0; i < size; ++i) {
+			hash = (hash ^ static_cast<unsigned char>(data[i])) * 16777619u;
+		}
+
+		return hash;
+	}
+
+	void load()
+	{
+		struct stat st;
+		if (::fstat(fd_, &st) != 0) {
+			throw std::system_error(errno, std::generic_category(), "fstat");
+		}
+
+		file_size_ = static_cast<uint64_t>(st.st_size);
+		if (file_size_ < file_header_size) {
+			//新文件,或者连文件头都没写完
+			truncate(0);
+			write_header(0, file_header_size);
+			file_size_ = file_header_size;
+			checkpoints_.push_back(checkpoint{ 0, file_size_ });
+			return;
+		}
+
+		char buf[file_header_size];
+		pread_all(buf, file_header_size, 0);
+		uint32_t magic;
+		uint32_t ver;
+		uint64_t last_index;
+		memcpy(&magic, buf, sizeof(magic));
+		memcpy(&ver, buf + 4, sizeof(ver));
+		memcpy(&last_index, buf + 8, sizeof(last_index));
+		memcpy(&committed_, buf + 16, sizeof(committed_));
+		if (magic != magic_value) {
+			throw std::runtime_error("record_log: not a record log");
+		}
+
+		if (ver != version) {
+			throw std::runtime_error("record_log: unsupported version");
+		}
+
+		synced_index_ = last_index;
+
+		if (!load_footer(last_index) && !load_index_chain(last_index)) {
+			//索引损坏,退回到全量扫描
+			checkpoints_.assign(1, checkpoint{ 0, file_header_size });
+			count_ = 0;
+			last_index_ = 0;
+			scan_tail(file_header_size);
+		}
+
+		if (last_index_ != synced_index_ || committed_ > file_size_) {
+			write_header(last_index_, std::min(committed_, file_size_));
+		}
+	}
+
+	//正常关闭时整份索引都在footer中
+	bool load_footer(uint64_t offset)
+	{
+		frame f;
+		std::string payload;
+		if (offset == 0 || !read_frame(offset, f, &payload) || f.type != frame_footer
+			|| offset + frame_header_size + f.length != file_size_) {
+			return false;
+		}
+
+		std::vector<std::pair<uint64_t, uint64_t> > index;
+		in_stream is(payload.data(), payload.size());
+		is >> last_index_ >> count_ >> index;
+		if (index.empty()) {
+			return false;
+		}
+
+		for (const auto& item : index) {
+			checkpoints_.push_back(checkpoint{ item.first, item.second });
+		}
+
+		//先让文件头指回索引链,再截掉footer,中途崩溃也能恢复
+		write_header(last_index_, offset);
+		if (::fdatasync(fd_) != 0) {
+			throw std::system_error(errno, std::generic_category(), "fdatasync");
+		}
+
+		truncate(offset);
+		return true;
+	}
+
+	//崩溃后沿索引链回溯,再扫描最后一段
+	bool load_index_chain(uint64_t offset)
+	{
+		std::vector<checkpoint> chain;
+		uint64_t tail_first = 0;
+		uint64_t tail_offset = file_header_size;
+		bool newest = true;
+
+		while (offset != 0) {
+			frame f;
+			std::string payload;
+			if (!read_frame(offset, f, &payload) || f.type != frame_index) {
+				return false;
+			}
+
+			uint64_t prev = 0;
+			checkpoint c;
+			uint64_t count = 0;
+			in_stream is(payload.data(), payload.size());
+			is >> prev >> c.record_no >> c.offset >> count;
+			chain.push_back(c);
+			if (prev >= offset) {
+				return false;
+			}
+
+			if (newest) {
+				tail_first = c.record_no + count;
+				tail_offset = offset + frame_header_size + f.length;
+				last_index_ = offset;
+				newest = false;
+			}
+
+			offset = prev;
+		}
+
+		checkpoints_.assign(chain.rbegin(), chain.rend());
+		checkpoints_.push_back(checkpoint{ tail_first, tail_offset });
+		count_ = tail_first;
+		scan_tail(tail_offset);
+		return true;
+	}
+
+	//从offset顺序扫描到文件尾,截掉最后一次提交之后写了一半的记录
+	//已提交范围内的帧损坏时抛出异常,不能丢掉后面的记录
+	void scan_tail(uint64_t offset)
+	{
+		for (;;) {
+			frame f;
+			std::string payload;
+			if (!read_frame(offset, f, &payload)) {
+				if (offset < committed_) {
+					throw std::runtime_error("record_log: corrupt record");
+				}
+
+				break;
+			}
+
+			if (f.type == frame_footer) {
+				break;
+			}
+
+			uint64_t next = offset + frame_header_size + f.length;
+			if (f.type == frame_record) {
+				++count_;
+			}
+			else if (f.type == frame_index) {
+				//文件头中的位置没来得及更新
+				last_index_ = offset;
+				checkpoints_.push_back(checkpoint{ count_, next });
+			}
+
+			offset = next;
+		}
+
+		if (offset < file_size_) {
+			truncate(offset);
+		}
+	}
+
+	//读出并校验offset处的帧,payload为空时只读帧头
+	bool read_frame(uint64_t offset, frame& f, std::string* payload)
+	{
+		char header[frame_header_size];
+		if (offset + frame_header_size > file_size_) {
+			return false;
+		}
+
+		pread_all(header, frame_header_size, offset);
+		uint32_t sum;
+		memcpy(&f.length, header, sizeof(f.length));
+		f.type = static_cast<unsigned char>(header[4]);
+		memcpy(&sum, header + 5, sizeof(sum));
+		if (offset + frame_header_size + f.length > file_size_) {
+			return false;
+		}
+
+		if (payload == nullptr) {
+			return true;
+		}
+
+		payload->resize(f.length);
+		if (f.length > 0) {
+			pread_all(&(*payload)[0], f.length, offset + frame_header_size);
+		}
+
+		return checksum(payload->data(), payload->size()) == sum;
+	}
+
+	uint64_t append_record(const segment* segments, size_t count)
+	{
+		append_frame(frame_record, segments, count);
+		uint64_t record_no = count_++;
+
+		if (count_ - checkpoints_.back().record_no == index_interval_) {
+			append_index();
+		}
+
+		if (batch_.size() >= group_bytes_) {
+			commit();
+		}
+
+		return record_no;
+	}
+
+	void append_frame(frame_type type, const char* data, size_t size)
+	{
+		segment seg(data, size);
+		append_frame(type, &seg, 1);
+	}
+
+	//把count段数据作为一帧的payload
+	void append_frame(frame_type type, const segment* segments, size_t count)
+	{
+		size_t size = 0;
+		for (size_t i = 0; i < count; ++i) {
+			size += segments[i].second;
+		}
+
+		if (size > 0xffffffffu) {
+			throw std::length_error("record_log: record exceeds 32 bits");
+		}
+
+		uint32_t sum = checksum_seed;
+		for (size_t i = 0; i < count; ++i) {
+			sum = checksum(segments[i].first, segments[i].second, sum);
+		}
+
+		uint32_t length = static_cast<uint32_t>(size);
+		char header[frame_header_size];
+		memcpy(header, &length, sizeof(length));
+		header[4] = static_cast<char>(type);
+		memcpy(header + 5, &sum, sizeof(sum));
+		batch_.append(header, frame_header_size);
+		for (size_t i = 0; i < count; ++i) {
+			batch_.append(segments[i].first, segments[i].second);
+		}
+	}
+
+	void append_index()
+	{
+		checkpoint c = checkpoints_.back();
+		uint64_t count = count_ - c.record_no;
+		uint64_t offset = file_size_ + batch_.size();
+
+		out_stream os;
+		os << last_index_ << c.record_no << c.offset << count;
+		append_frame(frame_index, os.buffer().data(), os.buffer().size());
+
+		last_index_ = offset;
+		checkpoints_.push_back(checkpoint{ count_, file_size_ + batch_.size() });
+	}
+
+	void flush()
+	{
+		if (batch_.empty()) {
+			return;
+		}
+
+		pwrite_all(batch_.data(), batch_.size(), file_size_);
+		file_size_ += batch_.size();
+		batch_.clear();
+	}
+
+	//committed之前的数据都已落盘
+	void write_header(uint64_t last_index, uint64_t committed)
+	{
+		char buf[file_header_size];
+		uint32_t magic = magic_value;
+		uint32_t ver = version;
+		memcpy(buf, &magic, sizeof(magic));
+		memcpy(buf + 4, &ver, sizeof(ver));
+		memcpy(buf + 8, &last_index, sizeof(last_index));
+		memcpy(buf + 16, &committed, sizeof(committed));
+		pwrite_all(buf, file_header_size, 0);
+		synced_index_ = last_index;
+		committed_ = committed;
+	}
+
+	void truncate(uint64_t size)
+	{
+		if (::ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+			throw std::system_error(errno, std::generic_category(), "ftruncate");
+		}
+
+		file_size_ = size;
+	}
+
+	void pread_all(char* buf, size_t size, uint64_t offset)
+	{
+		while (size > 0) {
+			ssize_t n = ::pread(fd_, buf, size, static_cast<off_t>(offset));
+			if (n <= 0) {
+				if (n < 0 && errno == EINTR) {
+					continue;
+				}
+
+				throw std::system_error(n < 0 ? errno : EIO, std::generic_category(), "pread");
+			}
+
+			buf += n;
+			size -= static_cast<size_t>(n);
+			offset += static_cast<uint64_t>(n);
+		}
+	}
+
+	void pwrite_all(const char* buf, size_t size, uint64_t offset)
+	{
+		while (size > 0) {
+			ssize_t n = ::pwrite(fd_, buf, size, static_cast<off_t>(offset));
+			if (n < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+
+				throw std::system_error(errno, std::generic_category(), "pwrite");
+			}
+
+			buf += n;
+			size -= static_cast<size_t>(n);
+			offset += static_cast<uint64_t>(n);
+		}
+	}
+
+private:
+	int fd_;
+	uint64_t file_size_;
+	uint64_t count_;
+	uint64_t last_index_;
+	uint64_t synced_index_;
+	uint64_t committed_;
+	size_t index_interval_;
+	size_t group_bytes_;
+	std::string batch_;
+	std::vector<checkpoint> checkpoints_;
+};
+
+#endif
@@ -0,0 +1,1019 @@
+#ifndef _RESUMABLE_STREAM_HEADER_H_
+#define _RESUMABLE_STREAM_HEADER_H_
+#include "serialize.h"
+#include <cstring>
+#include <memory>       //std::unique_ptr
+#include <type_traits>  //std::is_arithmetic
+
+////////////////////////////////////////////////////
+//resumable decoder for non-blocking I/O
+//
+//Targets are registered with operator>> in the same
+//order as in_stream, then bytes are fed as they arrive.
+//Decoding suspends anywhere, even inside a string or a
+//container, and continues on the next feed().Only a
+//scalar that straddles two feeds is buffered.
+//
+//With length_varint the chunks of large strings and
+//vectors are appended to the target as they arrive, so
+//a payload larger than 4G can be received without
+//holding the whole message in memory.
+//
+//Arithmetic types, strings, the standard containers,
+//pair, array, tuple and (C++17) optional and variant
+//are supported.Serializable types are not: their
+//encoded length is unknown until the whole object is
+//present.
+////////////////////////////////////////////////////
+
+namespace resumable {
+
+class step
+{
+public:
+	virtual ~step() = default;
+
+	//消费[p,end)中的数据,目标解码完成时返回true
+	virtual bool resume(const char*& p, const char* end) = 0;
+};
+
+template<typename Type, typename Enable = void>
+class decoder
+{
+	static_assert(sizeof(Type) == 0, "type can not be decoded incrementally");
+};
+
+//基本类型和无填充的pair/array整块解码,跨两次feed时先拼到tmp_中
+template<typename Type>
+class decoder<Type, typename std::enable_if<std::is_arithmetic<Type>::value || is_packed<Type>::value>::type>
+{
+public:
+	decoder() : a_(nullptr), got_(0)
+	{
+	}
+
+	void bind(Type& a, length_mode)
+	{
+		a_ = &a;
+		got_ = 0;
+	}
+
+	bool resume(const char*& p, const char* end)
+	{
+		if (got_ == 0 && static_cast<size_t>(end - p) >= sizeof(Type)) {
+			memcpy(static_cast<void*>(a_), p, sizeof(Type));
+			p += sizeof(Type);
+			return true;
+		}
+
+		size_t n = std::min(sizeof(Type) - got_, static_cast<size_t>(end - p));
+		memcpy(tmp_ + got_, p, n);
+		got_ += n;
+		p += n;
+		if (got_ < sizeof(Type)) {
+			return false;
+		}
+
+		memcpy(static_cast<void*>(a_), tmp_, sizeof(Type));
+		return true;
+	}
+
+private:
+	Type* a_;
+	size_t got_;
+	char tmp_[sizeof(Type)];
+};
+
+//长度前缀,length_fixed32为4字节,length_varint为变长整数
+class length_decoder
+{
+public:
+	length_decoder() : n_(nullptr), mode_(length_fixed32), fixed_(0), value_(0), shift_(0)
+	{
+	}
+
+	void bind(size_t& n, length_mode mode)
+	{
+		n_ = &n;
+		mode_ = mode;
+		value_ = 0;
+		shift_ = 0;
+		fixed_decoder_.bind(fixed_, mode);
+	}
+
+	bool resume(const char*& p, const char* end)
+	{
+		if (mode_ == length_fixed32) {
+			if (!fixed_decoder_.resume(p, end)) {
+				return false;
+			}
+
+			*n_ = fixed_;
+			return true;
+		}
+
+		while (p != end) {
+			if (shift_ > 63) {
+				throw std::out_of_range("deserialize: bad length");
+			}
+
+			unsigned char b = static_cast<unsigned char>(*p++);
+			value_ |= static_cast<uint64_t>(b & 0x7f) << shift_;
+			shift_ += 7;
+			if ((b & 0x80) == 0) {
+				if (value_ > static_cast<uint64_t>(static_cast<size_t>(-1))) {
+					throw std::length_error("deserialize: length exceeds size_t");
+				}
+
+				*n_ = static_cast<size_t>(value_);
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+private:
+	size_t* n_;
+	length_mode mode_;
+	unsigned int fixed_;
+	uint64_t value_;
+	int shift_;
+	decoder<unsigned int> fixed_decoder_;
+};
+
+//元素个数,chunked为真且是length_varint时按块给出,以0长度的块结束
+//resume返回true后left()个元素可读,left()为0表示全部读完
+class count_decoder
+{
+public:
+	count_decoder() : len_(0), mode_(length_fixed32), chunked_(false), last_(false)
+	{
+	}
+
+	void bind(length_mode mode, bool chunked)
+	{
+		len_ = 0;
+		mode_ = mode;
+		chunked_ = chunked && mode == length_varint;
+		last_ = false;
+		len_decoder_.bind(len_, mode);
+	}
+
+	bool resume(const char*& p, const char* end)
+	{
+		while (len_ == 0 && !last_) {
+			if (!len_decoder_.resume(p, end)) {
+				return false;
+			}
+
+			last_ = !chunked_ || len_ == 0;
+			len_decoder_.bind(len_, mode_);
+		}
+
+		return true;
+	}
+
+	size_t left() const
+	{
+		return len_;
+	}
+
+	void pop(size_t n = 1)
+	{
+		len_ -= n;
+	}
+
+private:
+	size_t len_;
+	length_mode mode_;
+	bool chunked_;
+	bool last_;
+	length_decoder len_decoder_;
+};
+
+//length_varint下字符串按块编码
+template<>
+class decoder<std::string>
+{
+public:
+	decoder() : s_(nullptr), started_(false)
+	{
+	}
+
+	void bind(std::string& s, length_mode mode)
+	{
+		s_ = &s;
+		started_ = false;
+		count_.bind(mode, true);
+	}
+
+	bool resume(const char*& p, const char* end)
+	{
+		for (;;) {
+			if (!count_.resume(p, end)) {
+				return false;
+			}
+
+			//长度还未经数据验证,只追加已到达的数据,容量随追加增长
+			if (!started_) {
+				started_ = true;
+				s_->clear();
+			}
+
+			if (count_.left() == 0) {
+				return true;
+			}
+
+			size_t n = std::min(count_.left(), static_cast<size_t>(end - p));
+			if (n == 0) {
+				return false;
+			}
+
+			s_->append(p, n);
+			p += n;
+			count_.pop(n);
+		}
+	}
+
+private:
+	std::string* s_;
+	bool started_;
+	count_decoder count_;
+};
+
+//length_varint下无填充的vector按块编码
+template<typename Container>
+struct packed_vector : std::false_type
+{
+};
+
+template<typename Type, typename Alloc>
+struct packed_vector<std::vector<Type, Alloc> > : std::integral_constant<bool, is_packed<Type>::value>
+{
+};
+
+//序列容器:读出长度后逐个emplace_back,再原位解码元素
+template<typename Container>
+class sequence_decoder
+{
+public:
+	typedef typename Container::value_type value_type;
+
+	sequence_decoder() : a_(nullptr), mode_(length_fixed32), in_item_(false)
+	{
+	}
+
+	void bind(Container& a, length_mode mode)
+	{
+		a_ = &a;
+		mode_ = mode;
+		in_item_ = false;
+		count_.bind(mode, packed_vector<Container>::value);
+	}
+
+	bool resume(const char*& p, const char* end)
+	{
+		for (;;) {
+			if (!count_.resume(p, end)) {
+				return false;
+			}
+
+			if (count_.left() == 0) {
+				return true;
+			}
+
+			if (!in_item_) {
+				copy_packed(p, end, packed_vector<Container>());
+				if (count_.left() == 0) {
+					continue;
+				}
+
+				if (p == end) {
+					return false;
+				}
+
+				a_->emplace_back();
+				item_.bind(a_->back(), mode_);
+				in_item_ = true;
+			}
+
+			if (!item_.resume(p, end)) {
+				return false;
+			}
+
+			in_item_ = false;
+			count_.pop();
+		}
+	}
+
+private:
+	//无填充的vector一次拷贝已到达的完整元素,跨两次feed的元素仍逐个解码
+	void copy_packed(const char*& p, const char* end, std::true_type)
+	{
+		size_t n = std::min(count_.left(), static_cast<size_t>(end - p) / sizeof(value_type));
+		if (n > 0) {
+			size_t base = a_->size();
+			a_->resize(base + n);
+			memcpy(static_cast<void*>(&(*a_)[base]), p, n * sizeof(value_type));
+			p += n * sizeof(value_type);
+			count_.pop(n);
+		}
+	}
+
+	void copy_packed(const char*&, const char*, std::false_type)
+	{
+	}
+
+private:
+	Container* a_;
+	length_mode mode_;
+	bool in_item_;
+	count_decoder count_;
+	decoder<value_type> item_;
+};
+
+//集合容器:元素先解码到item_,完成后移动插入
+//out_stream按vector写出集合,元素无填充时同样按块编码
+template<typename Container>
+class set_decoder
+{
+public:
+	typedef typename Container::value_type value_type;
+
+	set_decoder() : a_(nullptr), mode_(length_fixed32), in_item_(false)
+	{
+	}
+
+	void bind(Container& a, length_mode mode)
+	{
+		a_ = &a;
+		mode_ = mode;
+		in_item_ = false;
+		count_.bind(mode, is_packed<value_type>::value);
+	}
+
+	bool resume(const char*& p, const char* end)
+	{
+		for (;;) {
+			if (!count_.resume(p, end)) {
+				return false;
+			}
+
+			if (count_.left() == 0) {
+				return true;
+			}
+
+			if (!in_item_) {
+				if (p == end) {
+					return false;
+				}
+
+				item_decoder_.bind(item_, mode_);
+				in_item_ = true;
+			}
+
+			if (!item_decoder_.resume(p, end)) {
+				return false;
+			}
+
+			a_->emplace(std::move(item_));
+			in_item_ = false;
+			count_.pop();
+		}
+	}
+
+private:
+	Container* a_;
+	length_mode mode_;
+	bool in_item_;
+	value_type item_;
+	count_decoder count_;
+	decoder<value_type> item_decoder_;
+};
+
+//有序映射容器按out_stream的格式先是全部key,再是全部value
+template<typename Container>
+class map_decoder
+{
+public:
+	typedef typename Container::key_type key_type;
+	typedef typename Container::mapped_type mapped_type;
+
+	map_decoder() : a_(nullptr), mode_(length_fixed32), index_(0), has_keys_(false), in_item_(false)
+	{
+	}
+
+	void bind(Container& a, length_mode mode)
+	{
+		a_ = &a;
+		mode_ = mode;
+		keys_.clear();
+		index_ = 0;
+		has_keys_ = false;
+		in_item_ = false;
+		keys_decoder_.bind(keys_, mode);
+		count_.bind(mode, is_packed<mapped_type>::value);
+	}
+
+	bool resume(const char*& p, const char* end)
+	{
+		if (!has_keys_) {
+			if (!keys_decoder_.resume(p, end)) {
+				return false;
+			}
+
+			has_keys_ = true;
+		}
+
+		for (;;) {
+			if (!count_.resume(p, end)) {
+				return false;
+			}
+
+			if (count_.left() == 0) {
+				break;
+			}
+
+			if (!in_item_) {
+				if (p == end) {
+					return false;
+				}
+
+				value_decoder_.bind(value_, mode_);
+				in_item_ = true;
+			}
+
+			if (!value_decoder_.resume(p, end)) {
+				return false;
+			}
+
+			if (index_ < keys_.size()) {
+				a_->emplace(std::move(keys_[index_]), std::move(value_));
+			}
+
+			in_item_ = false;
+			++index_;
+			count_.pop();
+		}
+
+		keys_.clear();
+		return true;
+	}
+
+private:
+	Container* a_;
+	length_mode mode_;
+	std::vector<key_type> keys_;
+	mapped_type value_;
+	size_t index_;
+	bool has_keys_;
+	bool in_item_;
+	sequence_decoder<std::vector<key_type> > keys_decoder_;
+	count_decoder count_;
+	decoder<mapped_type> value_decoder_;
+};
+
+//哈希容器:元素个数、桶数、最大负载因子,后面是逐个的元素
+template<typename Container>
+class hashed_decoder
+{
+public:
+	typedef typename Container::value_type value_type;
+
+	hashed_decoder() : a_(nullptr), mode_(length_fixed32), len_(0), bucket_count_(0), max_load_factor_(0), header_(0), decoded_(0), in_item_(false)
+	{
+	}
+
+	void bind(Container& a, length_mode mode)
+	{
+		a_ = &a;
+		mode_ = mode;
+		header_ = 0;
+		decoded_ = 0;
+		in_item_ = false;
+		len_decoder_.bind(len_, mode);
+	}
+
+	bool resume(const char*& p, const char* end)
+	{
+		if (!resume_header(p, end)) {
+			return false;
+		}
+
+		while (len_ > 0) {
+			if (!in_item_) {
+				if (p == end) {
+					return false;
+				}
+
+				entry_.bind(mode_);
+				in_item_ = true;
+			}
+
+			if (!entry_.resume(p, end)) {
+				return false;
+			}
+
+			entry_.insert(*a_);
+			in_item_ = false;
+			++decoded_;
+			--len_;
+		}
+
+		//头部到达时数据不足,元素到齐后再按实际个数恢复桶数
+		if (bucket_count_ > a_->bucket_count() && bucket_count_ <= decoded_ * 4 + 16) {
+			a_->rehash(bucket_count_);
+		}
+
+		return true;
+	}
+
+private:
+	bool resume_header(const char*& p, const char* end)
+	{
+		if (header_ == 0) {
+			if (!len_decoder_.resume(p, end)) {
+				return false;
+			}
+
+			++header_;
+			bucket_decoder_.bind(bucket_count_, mode_);
+		}
+
+		if (header_ == 1) {
+			if (!bucket_decoder_.resume(p, end)) {
+				return false;
+			}
+
+			++header_;
+			load_factor_decoder_.bind(max_load_factor_, mode_);
+		}
+
+		if (header_ == 2) {
+			if (!load_factor_decoder_.resume(p, end)) {
+				return false;
+			}
+
+			++header_;
+			//追加到非空容器时保留调用者设置的负载因子
+			if (a_->empty() && valid_load_factor(max_load_factor_)) {
+				a_->max_load_factor(max_load_factor_);
+			}
+
+			//元素个数还未经数据验证,每个元素至少一个字节,只按已到达的数据预留
+			size_t bound = std::min(len_, static_cast<size_t>(end - p));
+			a_->reserve(a_->size() + bound);
+			if (bucket_count_ > a_->bucket_count() && bucket_count_ <= bound * 4 + 16) {
+				a_->rehash(bucket_count_);
+			}
+		}
+
+		return true;
+	}
+
+	template<typename Type, typename Enable = void>
+	class entry
+	{
+	public:
+		void bind(length_mode mode)
+		{
+			decoder_.bind(item_, mode);
+		}
+
+		bool resume(const char*& p, const char* end)
+		{
+			return decoder_.resume(p, end);
+		}
+
+		void insert(Container& a)
+		{
+			a.emplace(std::move(item_));
+		}
+
+	private:
+		Type item_;
+		decoder<Type> decoder_;
+	};
+
+	template<typename Key, typename Value>
+	class entry<std::pair<const Key, Value> >
+	{
+	public:
+		entry() : mode_(length_fixed32), has_key_(false)
+		{
+		}
+
+		void bind(length_mode mode)
+		{
+			mode_ = mode;
+			has_key_ = false;
+			key_decoder_.bind(key_, mode);
+		}
+
+		bool resume(const char*& p, const char* end)
+		{
+			if (!has_key_) {
+				if (!key_decoder_.resume(p, end)) {
+					return false;
+				}
+
+				has_key_ = true;
+				value_decoder_.bind(value_, mode_);
+			}
+
+			return value_decoder_.resume(p, end);
+		}
+
+		void insert(Container& a)
+		{
+			a.emplace(std::move(key_), std::move(value_));
+		}
+
+	private:
+		Key key_;
+		Value value_;
+		length_mode mode_;
+		bool has_key_;
+		decoder<Key> key_decoder_;
+		decoder<Value> value_decoder_;
+	};
+
+private:
+	Container* a_;
+	length_mode mode_;
+	size_t len_;
+	size_t bucket_count_;
+	float max_load_factor_;
+	int header_;
+	size_t decoded_;
+	bool in_item_;
+	length_decoder len_decoder_;
+	length_decoder bucket_decoder_;
+	decoder<float> load_factor_decoder_;
+	entry<value_type> entry_;
+};
+
+//有填充或含有变长成员的pair,依次解码两个成员
+template<typename TypeA, typename TypeB>
+class decoder<std::pair<TypeA, TypeB>, typename std::enable_if<!is_packed<std::pair<TypeA, TypeB> >::value>::type>
+{
+public:
+	decoder() : has_first_(false)
+	{
+	}
+
+	void bind(std::pair<TypeA, TypeB>& a, length_mode mode)
+	{
+		has_first_ = false;
+		first_.bind(a.first, mode);
+		second_.bind(a.second, mode);
+	}
+
+	bool resume(const char*& p, const char* end)
+	{
+		if (!has_first_) {
+			if (!first_.resume(p, end)) {
+				return false;
+			}
+
+			has_first_ = true;
+		}
+
+		return second_.resume(p, end);
+	}
+
+private:
+	bool has_first_;
+	decoder<TypeA> first_;
+	decoder<TypeB> second_;
+};
+
+template<typename Type, size_t N>
+class decoder<std::array<Type, N>, typename std::enable_if<!is_packed<std::array<Type, N> >::value>::type>
+{
+public:
+	decoder() : a_(nullptr), mode_(length_fixed32), index_(0), in_item_(false)
+	{
+	}
+
+	void bind(std::array<Type, N>& a, length_mode mode)
+	{
+		a_ = &a;
+		mode_ = mode;
+		index_ = 0;
+		in_item_ = false;
+	}
+
+	bool resume(const char*& p, const char* end)
+	{
+		while (index_ < N) {
+			if (!in_item_) {
+				item_.bind((*a_)[index_], mode_);
+				in_item_ = true;
+			}
+
+			if (!item_.resume(p, end)) {
+				return false;
+			}
+
+			in_item_ = false;
+			++index_;
+		}
+
+		return true;
+	}
+
+private:
+	std::array<Type, N>* a_;
+	length_mode mode_;
+	size_t index_;
+	bool in_item_;
+	decoder<Type> item_;
+};
+
+//tuple的每个成员有自己的decoder,index_是正在解码的成员
+template<typename... Types>
+class decoder<std::tuple<Types...> >
+{
+public:
+	decoder() : index_(0)
+	{
+	}
+
+	void bind(std::tuple<Types...>& a, length_mode mode)
+	{
+		index_ = 0;
+		bind_items(a, mode, std::integral_constant<size_t, 0>());
+	}
+
+	bool resume(const char*& p, const char* end)
+	{
+		return resume_items(p, end, std::integral_constant<size_t, 0>());
+	}
+
+private:
+	template<size_t I>
+	void bind_items(std::tuple<Types...>& a, length_mode mode, std::integral_constant<size_t, I>)
+	{
+		std::get<I>(items_).bind(std::get<I>(a), mode);
+		bind_items(a, mode, std::integral_constant<size_t, I + 1>());
+	}
+
+	void bind_items(std::tuple<Types...>&, length_mode, std::integral_constant<size_t, sizeof...(Types)>)
+	{
+	}
+
+	template<size_t I>
+	bool resume_items(const char*& p, const char* end, std::integral_constant<size_t, I>)
+	{
+		if (index_ == I) {
+			if (!std::get<I>(items_).resume(p, end)) {
+				return false;
+			}
+
+			++index_;
+		}
+
+		return resume_items(p, end, std::integral_constant<size_t, I + 1>());
+	}
+
+	bool resume_items(const char*&, const char*, std::integral_constant<size_t, sizeof...(Types)>)
+	{
+		return true;
+	}
+
+private:
+	size_t index_;
+	std::tuple<decoder<Types>...> items_;
+};
+
+#ifdef SERIALIZE_HAS_CXX17
+//一个字节的标志位,有值时后跟值
+template<typename Type>
+class decoder<std::optional<Type> >
+{
+public:
+	decoder() : a_(nullptr), mode_(length_fixed32), flag_(0), has_flag_(false)
+	{
+	}
+
+	void bind(std::optional<Type>& a, length_mode mode)
+	{
+		a_ = &a;
+		mode_ = mode;
+		has_flag_ = false;
+		flag_decoder_.bind(flag_, mode);
+	}
+
+	bool resume(const char*& p, const char* end)
+	{
+		if (!has_flag_) {
+			if (!flag_decoder_.resume(p, end)) {
+				return false;
+			}
+
+			has_flag_ = true;
+			if (flag_ == 0) {
+				a_->reset();
+				return true;
+			}
+
+			if (!a_->has_value()) {
+				a_->emplace();
+			}
+
+			item_.bind(**a_, mode_);
+		}
+
+		return flag_ == 0 || item_.resume(p, end);
+	}
+
+private:
+	std::optional<Type>* a_;
+	length_mode mode_;
+	unsigned char flag_;
+	bool has_flag_;
+	decoder<unsigned char> flag_decoder_;
+	decoder<Type> item_;
+};
+
+//unsigned int的下标,后跟当前的值
+template<typename... Types>
+class decoder<std::variant<Types...> >
+{
+public:
+	decoder() : a_(nullptr), mode_(length_fixed32), index_(0), has_index_(false)
+	{
+	}
+
+	void bind(std::variant<Types...>& a, length_mode mode)
+	{
+		a_ = &a;
+		mode_ = mode;
+		has_index_ = false;
+		index_decoder_.bind(index_, mode);
+	}
+
+	bool resume(const char*& p, const char* end)
+	{
+		if (!has_index_) {
+			if (!index_decoder_.resume(p, end)) {
+				return false;
+			}
+
+			if (index_ >= sizeof...(Types)) {
+				throw std::out_of_range("deserialize: bad variant index");
+			}
+
+			has_index_ = true;
+			bind_item(std::integral_constant<size_t, 0>());
+		}
+
+		return resume_item(p, end, std::integral_constant<size_t, 0>());
+	}
+
+private:
+	template<size_t I>
+	void bind_item(std::integral_constant<size_t, I>)
+	{
+		if (index_ != I) {
+			bind_item(std::integral_constant<size_t, I + 1>());
+			return;
+		}
+
+		if (a_->index() != I) {
+			a_->template emplace<I>();
+		}
+
+		std::get<I>(items_).bind(std::get<I>(*a_), mode_);
+	}
+
+	void bind_item(std::integral_constant<size_t, sizeof...(Types)>)
+	{
+	}
+
+	template<size_t I>
+	bool resume_item(const char*& p, const char* end, std::integral_constant<size_t, I>)
+	{
+		if (index_ != I) {
+			return resume_item(p, end, std::integral_constant<size_t, I + 1>());
+		}
+
+		return std::get<I>(items_).resume(p, end);
+	}
+
+	bool resume_item(const char*&, const char*, std::integral_constant<size_t, sizeof...(Types)>)
+	{
+		return true;
+	}
+
+private:
+	std::variant<Types...>* a_;
+	length_mode mode_;
+	unsigned int index_;
+	bool has_index_;
+	decoder<unsigned int> index_decoder_;
+	std::tuple<decoder<Types>...> items_;
+};
+#endif
+
+#define DEF_RESUMABLE_DECODER(Container, Impl) \
+template<typename... Args> \
+class decoder<Container<Args...> > : public Impl<Container<Args...> > \
+{ \
+};
+
+DEF_RESUMABLE_DECODER(std::vector, sequence_decoder)
+DEF_RESUMABLE_DECODER(std::list, sequence_decoder)
+DEF_RESUMABLE_DECODER(std::deque, sequence_decoder)
+DEF_RESUMABLE_DECODER(std::set, set_decoder)
+DEF_RESUMABLE_DECODER(std::multiset, set_decoder)
+DEF_RESUMABLE_DECODER(std::unordered_set, hashed_decoder)
+DEF_RESUMABLE_DECODER(std::unordered_multiset, hashed_decoder)
+DEF_RESUMABLE_DECODER(std::map, map_decoder)
+DEF_RESUMABLE_DECODER(std::multimap, map_decoder)
+DEF_RESUMABLE_DECODER(std::unordered_map, hashed_decoder)
+DEF_RESUMABLE_DECODER(std::unordered_multimap, hashed_decoder)
+
+template<typename Type>
+class target_step : public step
+{
+public:
+	target_step(Type& a, length_mode mode)
+	{
+		decoder_.bind(a, mode);
+	}
+
+	virtual bool resume(const char*& p, const char* end)
+	{
+		return decoder_.resume(p, end);
+	}
+
+private:
+	decoder<Type> decoder_;
+};
+
+}//namespace resumable
+
+class resumable_in_stream
+{
+public:
+	resumable_in_stream() : current_(0), total_(0), length_mode_(length_fixed32)
+	{
+	}
+
+	~resumable_in_stream() = default;
+
+	//与out_stream的设置一致,只影响之后登记的目标
+	void set_length_mode(length_mode mode)
+	{
+		length_mode_ = mode;
+	}
+
+	//登记下一个要解码的目标,顺序与out_stream写入顺序一致
+	template<typename Type>
+	resumable_in_stream& operator>> (Type& a)
+	{
+		steps_.emplace_back(new resumable::target_step<Type>(a, length_mode_));
+		return *this;
+	}
+
+	//喂入新到达的数据,返回消费的字节数
+	//全部目标解码完成后剩余的数据不会被消费
+	size_t feed(const char* data, size_t size)
+	{
+		const char* p = data;
+		const char* end = data + size;
+		while (current_ < steps_.size() && steps_[current_]->resume(p, end)) {
+			++current_;
+		}
+
+		total_ += p - data;
+		return p - data;
+	}
+
+	size_t feed(const std::string& s)
+	{
+		return feed(s.data(), s.size());
+	}
+
+	bool done() const
+	{
+		return current_ == steps_.size();
+	}
+
+	//已消费的字节数
+	size_t size() const
+	{
+		return total_;
+	}
+
+private:
+	std::vector<std::unique_ptr<resumable::step> > steps_;
+	size_t current_;
+	size_t total_;
+	length_mode length_mode_;
+};
+
+#endif
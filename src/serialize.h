@@ -7,11 +7,24 @@
 #include <map>     //std::map
 #include <utility>    // std::pair
 #include <iterator>  //std::back_inserter
-#include <string>  //memcpy
+#include <string>  //std::string
+#include <cstring> //memcpy
+#include <stdexcept> //std::out_of_range
+#include <algorithm> //std::min
 #include <forward_list>
 #include <unordered_map>
 #include <unordered_set>
 #include <deque>
+#include <array>
+#include <tuple>
+#include <type_traits>
+#include <stdint.h>
+
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#define SERIALIZE_HAS_CXX17 1
+#include <optional>
+#include <variant>
+#endif
 
 ////////////////////////////////////////////
 //Serialize for custom class object
@@ -37,12 +50,28 @@ static std::string serialize(SerializableType& a)
 	return a.serialize();
 }
 
+//直接追加到out末尾,不产生临时字符串
+template<typename SerializableType = Serializable>
+static void serialize(SerializableType& a, std::string& out)
+{
+	out.append(a.serialize());
+}
+
 template<typename SerializableType = Serializable>
 static unsigned int deserialize(std::string& str, SerializableType& a)
 {
 	return a.deserialize(str);
 }
 
+//从缓冲区指定位置反序列化
+//Serializable的编码不带长度,接口又要求std::string,只能把剩余的数据整个拷贝一次,
+//所以解码Serializable对象的容器时,开销与元素个数乘以剩余长度成正比
+template<typename SerializableType = Serializable>
+static unsigned int deserialize(const char* data, size_t size, SerializableType& a)
+{
+	return a.deserialize(std::string(data, size));
+}
+
 /////////////////////////////////////////////////
 //define special template function
 //Serialize for C/C++ basic type
@@ -50,24 +79,44 @@ static unsigned int deserialize(std::string& str, SerializableType& a)
 /////////////////////////////////////////////////
 #define DEF_BASIC_TYPE_SERIALIZE(Type) \
  template<> \
-static std::string serialize(Type& b) \
+inline std::string serialize(Type& b) \
 { \
         std::string ret; \
         ret.append((const char*)&b,sizeof(Type)); \
         return std::move(ret); \
 }
 
+#define DEF_BASIC_TYPE_SERIALIZE_TO(Type) \
+ template<> \
+inline void serialize(Type& b,std::string& out) \
+{ \
+        out.append((const char*)&b,sizeof(Type)); \
+}
+
 #define DEF_BASIC_TYPE_DESERIALIZE(Type)  \
  template<> \
-static unsigned int deserialize(std::string& str,Type& b)\
+inline unsigned int deserialize(std::string& str,Type& b)\
 { \
         memcpy(&b,str.data(),sizeof(Type)); \
         return sizeof(Type); \
 }
 
+#define DEF_BASIC_TYPE_DESERIALIZE_FROM(Type)  \
+ template<> \
+inline unsigned int deserialize(const char* data,size_t size,Type& b)\
+{ \
+        if (size < sizeof(Type)) { \
+                throw std::out_of_range("deserialize: buffer too short"); \
+        } \
+        memcpy(&b,data,sizeof(Type)); \
+        return sizeof(Type); \
+}
+
 #define DEF_BASIC_TYPE_SERIALIZE_AND_DESERIALIZE(Type) \
         DEF_BASIC_TYPE_SERIALIZE(Type) \
-        DEF_BASIC_TYPE_DESERIALIZE(Type)
+        DEF_BASIC_TYPE_SERIALIZE_TO(Type) \
+        DEF_BASIC_TYPE_DESERIALIZE(Type) \
+        DEF_BASIC_TYPE_DESERIALIZE_FROM(Type)
 
 DEF_BASIC_TYPE_SERIALIZE_AND_DESERIALIZE(char)
 DEF_BASIC_TYPE_SERIALIZE_AND_DESERIALIZE(unsigned char)
@@ -88,7 +137,7 @@ DEF_BASIC_TYPE_SERIALIZE_AND_DESERIALIZE(double)
 
 // for c++ type std::string
 template<>
-static std::string serialize(std::string& s)
+inline std::string serialize(std::string& s)
 {
 	unsigned int len = static_cast<unsigned int>(s.size());
 	std::string ret;
@@ -98,76 +147,342 @@ static std::string serialize(std::string& s)
 }
 
 template<>
-static unsigned int deserialize(std::string& str, std::string& s)
+inline void serialize(std::string& s, std::string& out)
+{
+	unsigned int len = static_cast<unsigned int>(s.size());
+	::serialize(len, out);
+	out.append(s.data(), len);
+}
+
+template<>
+inline unsigned int deserialize(std::string& str, std::string& s)
 {
 	unsigned int len;
 	::deserialize(str, len);
-	s = str.substr(sizeof(len), len);
+	s.assign(str, sizeof(len), len);
 	return sizeof(int) + len;
 }
 
+//assign复用s已有的容量
+template<>
+inline unsigned int deserialize(const char* data, size_t size, std::string& s)
+{
+	unsigned int len;
+	::deserialize(data, size, len);
+	if (size - sizeof(len) < len) {
+		throw std::out_of_range("deserialize: string truncated");
+	}
+
+	s.assign(data + sizeof(len), len);
+	return sizeof(len) + len;
+}
+
+////////////////////////////////////////////
+//compile-time layout analysis
+//packed_size is the encoded size of a type that is
+//written member by member without padding, or 0 if
+//the type has no fixed size.When it equals sizeof,
+//the memory image is the encoding and can be copied
+//as one block.
+////////////////////////////////////////////
+
+template<typename Type>
+struct packed_size : std::integral_constant<size_t,
+	std::is_arithmetic<Type>::value && !std::is_same<Type, bool>::value ? sizeof(Type) : 0>
+{
+};
+
+template<typename TypeA, typename TypeB>
+struct packed_size<std::pair<TypeA, TypeB> > : std::integral_constant<size_t,
+	packed_size<TypeA>::value != 0 && packed_size<TypeB>::value != 0
+	? packed_size<TypeA>::value + packed_size<TypeB>::value : 0>
+{
+};
+
+template<typename Type, size_t N>
+struct packed_size<std::array<Type, N> > : std::integral_constant<size_t, packed_size<Type>::value * N>
+{
+};
+
+//std::tuple的成员在内存中的顺序由实现决定,不做整块拷贝
+template<typename Type>
+struct is_packed : std::integral_constant<bool, packed_size<Type>::value != 0 && packed_size<Type>::value == sizeof(Type)>
+{
+};
+
 ////////////////////////////////////////////
 //define input and output stream
 //for serialize data struct
 ////////////////////////////////////////////
 
+//长度前缀的编码方式,编码和解码两端必须一致
+enum length_mode
+{
+	length_fixed32,	//4字节长度(默认,即不设置length_mode时的格式),超过4G时抛出std::length_error
+	length_varint	//变长的64位长度,字符串和无填充的vector按块编码:块长,数据,...,0
+};
+
+//线程局部的缓冲区池
+//按容量分级缓存用过的缓冲区,每级最多保留max_count个,
+//超过max_capacity的缓冲区直接释放,避免一次大消息长期占用内存
+class buffer_pool
+{
+public:
+	static const size_t class_count = 4;
+
+	buffer_pool() : max_count_(8), max_capacity_(4 << 20)
+	{
+	}
+
+	~buffer_pool() = default;
+
+	static buffer_pool& local()
+	{
+		static thread_local buffer_pool pool;
+		return pool;
+	}
+
+	void set_limits(size_t max_count, size_t max_capacity)
+	{
+		max_count_ = max_count;
+		max_capacity_ = max_capacity;
+		for (auto& free : free_) {
+			while (free.size() > max_count_ || (!free.empty() && free.back().capacity() > max_capacity_)) {
+				free.pop_back();
+			}
+		}
+	}
+
+	//取一个容量不小于hint的空缓冲区,没有时新分配
+	//新缓冲区的容量向上取到所在级的下限,归还后仍落在同一级,下次同样大小的请求可以复用
+	std::string acquire(size_t hint = 0)
+	{
+		size_t first = class_of(hint);
+		for (size_t i = first; i < class_count; ++i) {
+			if (!free_[i].empty()) {
+				std::string buf = std::move(free_[i].back());
+				free_[i].pop_back();
+				buf.reserve(hint);
+				return buf;
+			}
+		}
+
+		std::string buf;
+		buf.reserve(std::max(hint, class_limit(first)));
+		return buf;
+	}
+
+	void release(std::string&& buf)
+	{
+		size_t capacity = buf.capacity();
+		if (capacity > max_capacity_) {
+			return;
+		}
+
+		//按实际容量向下取级,保证acquire取到的容量不小于所求,太小的不缓存
+		if (capacity < class_limit(0)) {
+			return;
+		}
+
+		size_t i = class_of(capacity);
+		if (capacity < class_limit(i)) {
+			--i;
+		}
+
+		if (free_[i].size() < max_count_) {
+			buf.clear();
+			free_[i].emplace_back(std::move(buf));
+		}
+	}
+
+private:
+	static size_t class_limit(size_t i)
+	{
+		//256B 4KB 64KB 1MB,最后一级保存1MB到max_capacity之间的缓冲区
+		return static_cast<size_t>(256) << (4 * i);
+	}
+
+	static size_t class_of(size_t size)
+	{
+		size_t i = 0;
+		while (i + 1 < class_count && size > class_limit(i)) {
+			++i;
+		}
+
+		return i;
+	}
+
+private:
+	std::vector<std::string> free_[class_count];
+	size_t max_count_;
+	size_t max_capacity_;
+};
+
 class out_stream
 {
 public:
-	out_stream() : os_(std::ios::binary | std::ios::out)
+	out_stream() : pool_(nullptr), reference_threshold_(0), length_mode_(length_fixed32), chunk_size_(1 << 20)
 	{
 
 	}
 
-	~out_stream() = default;
+	//从pool取预热过的缓冲区,析构时归还
+	explicit out_stream(buffer_pool& pool, size_t hint = 0)
+		: buf_(pool.acquire(hint)), pool_(&pool), reference_threshold_(0), length_mode_(length_fixed32), chunk_size_(1 << 20)
+	{
+	}
+
+	out_stream(const out_stream&) = delete;
+	out_stream& operator=(const out_stream&) = delete;
+
+	~out_stream()
+	{
+		if (pool_ != nullptr) {
+			pool_->release(std::move(buf_));
+		}
+	}
+
+	//清空已写数据,保留缓冲区容量
+	void reset()
+	{
+		buf_.clear();
+		refs_.clear();
+	}
+
+	void set_length_mode(length_mode mode)
+	{
+		length_mode_ = mode;
+	}
+
+	//length_varint下每块的最大字节数
+	void set_chunk_size(size_t chunk_size)
+	{
+		chunk_size_ = chunk_size > 0 ? chunk_size : 1;
+	}
+
+	//length_varint下分段写出一个大字符串,不需要先把整块数据拼在一起
+	//依次调用write_chunk,最后调用end_chunks,解码端按std::string或std::vector<char>读取
+	void write_chunk(const char* data, size_t size)
+	{
+		if (length_mode_ != length_varint) {
+			throw std::logic_error("out_stream: chunks need length_varint");
+		}
+
+		if (size > 0) {
+			write_length(size);
+			write_block(data, size);
+		}
+	}
+
+	void end_chunks()
+	{
+		if (length_mode_ != length_varint) {
+			throw std::logic_error("out_stream: chunks need length_varint");
+		}
+
+		write_length(0);
+	}
+
+	//与外部字符串交换内部缓冲区,便于直接编码到调用者持有的缓冲区中
+	void swap_buffer(std::string& buf)
+	{
+		buf_.swap(buf);
+		refs_.clear();
+	}
+
+	//不小于threshold字节的字符串和无填充的vector只记录地址不拷贝,0表示关闭
+	//被引用的数据在输出完成前必须保持有效且不被修改
+	void set_reference_threshold(size_t threshold)
+	{
+		reference_threshold_ = threshold;
+	}
 
 	template<typename SerializableType>
 	out_stream& operator<< (SerializableType& a)
 	{
-		std::string x = ::serialize(a);
-		os_.write(x.data(), x.size());
+		::serialize(a, buf_);
+		return *this;
+	}
+
+	out_stream& operator<< (std::string& a)
+	{
+		write_bytes(a.data(), a.size(), 1);
 		return *this;
 	}
 
 	template<typename BasicType>
 	out_stream& operator<< (std::vector<BasicType>& a)
 	{
-		unsigned int len = static_cast<unsigned int>(a.size());
+		write_vector(a, is_packed<BasicType>());
+		return *this;
+	}
+
+	template<typename BasicTypeA, typename BasicTypeB>
+	out_stream& operator<< (std::pair<BasicTypeA, BasicTypeB>& a)
+	{
+		write_pair(a, is_packed<std::pair<BasicTypeA, BasicTypeB> >());
+		return *this;
+	}
+
+	template<typename BasicType, size_t N>
+	out_stream& operator<< (std::array<BasicType, N>& a)
+	{
+		write_array(a, is_packed<std::array<BasicType, N> >());
+		return *this;
+	}
 
-		std::string x = ::serialize(len);
-		os_.write(x.data(), x.size());
+	template<typename... BasicTypes>
+	out_stream& operator<< (std::tuple<BasicTypes...>& a)
+	{
+		write_tuple<0>(a);
+		return *this;
+	}
 
-		for (unsigned int i = 0; i < len; ++i) {
-			std::string item = ::serialize(a[i]);
-			os_.write(item.data(), item.size());
+#ifdef SERIALIZE_HAS_CXX17
+	//一个字节的标志位,有值时后跟值
+	template<typename BasicType>
+	out_stream& operator<< (std::optional<BasicType>& a)
+	{
+		unsigned char has_value = a.has_value() ? 1 : 0;
+		*this << has_value;
+		if (a.has_value()) {
+			*this << *a;
 		}
 
 		return *this;
 	}
 
+	//unsigned int的下标,后跟当前的值
+	template<typename... BasicTypes>
+	out_stream& operator<< (std::variant<BasicTypes...>& a)
+	{
+		unsigned int index = static_cast<unsigned int>(a.index());
+		*this << index;
+		std::visit([this](auto& item) { *this << item; }, a);
+		return *this;
+	}
+#endif
+
 	template<typename BasicType>
 	out_stream& operator<< (std::list<BasicType>& a)
 	{
-		std::vector<BasicType> temp;
-		std::copy(a.begin(), a.end(), std::back_inserter(temp));
-		return this->operator<< (temp);
+		write_sequence(a, a.size());
+		return *this;
 	}
 
 	//c++11单链表
 	template<typename BasicType>
 	out_stream& operator<< (std::forward_list<BasicType>& a)
 	{
-		std::vector<BasicType> temp;
-		std::copy(a.begin(), a.end(), std::back_inserter(temp));
-		return this->operator<< (temp);
+		write_sequence(a, std::distance(a.begin(), a.end()));
+		return *this;
 	}
 
 	template<typename BasicType>
 	out_stream& operator<< (std::deque<BasicType>& a)
 	{
-		std::vector<BasicType> temp;
-		std::copy(a.begin(), a.end(), std::back_inserter(temp));
-		return this->operator<< (temp);
+		write_sequence(a, a.size());
+		return *this;
 	}
 
 	template<typename BasicType>
@@ -178,20 +493,18 @@ public:
 		return this->operator<< (temp);
 	}
 
-	template<typename BasicType>
-	out_stream& operator<< (std::unordered_set<BasicType>& a)
+	template<typename BasicType, typename Hash, typename Pred, typename Alloc>
+	out_stream& operator<< (std::unordered_set<BasicType, Hash, Pred, Alloc>& a)
 	{
-		std::vector<BasicType> temp;
-		std::copy(a.begin(), a.end(), std::back_inserter(temp));
-		return this->operator<< (temp);
+		write_hashed(a);
+		return *this;
 	}
 
-	template<typename BasicType>
-	out_stream& operator<< (std::unordered_multiset<BasicType>& a)
+	template<typename BasicType, typename Hash, typename Pred, typename Alloc>
+	out_stream& operator<< (std::unordered_multiset<BasicType, Hash, Pred, Alloc>& a)
 	{
-		std::vector<BasicType> temp;
-		std::copy(a.begin(), a.end(), std::back_inserter(temp));
-		return this->operator<< (temp);
+		write_hashed(a);
+		return *this;
 	}
 
 	template<typename BasicTypeA, typename BasicTypeB>
@@ -215,131 +528,461 @@ public:
 		return this->operator<< (temp_val);
 	}
 
-	template<typename BasicTypeA, typename BasicTypeB>
-	out_stream& operator<< (std::unordered_map<BasicTypeA, BasicTypeB>& a)
+	template<typename BasicTypeA, typename BasicTypeB, typename Hash, typename Pred, typename Alloc>
+	out_stream& operator<< (std::unordered_map<BasicTypeA, BasicTypeB, Hash, Pred, Alloc>& a)
 	{
-		std::vector<BasicTypeA> temp_key;
-		std::vector<BasicTypeB> temp_val;
+		write_hashed(a);
+		return *this;
+	}
 
-		for (const auto& info : a) {
-			temp_key.emplace_back(info.first);
-			temp_val.emplace_back(info.second);
+	template<typename BasicTypeA, typename BasicTypeB, typename Hash, typename Pred, typename Alloc>
+	out_stream& operator<< (std::unordered_multimap<BasicTypeA, BasicTypeB, Hash, Pred, Alloc>& a)
+	{
+		write_hashed(a);
+		return *this;
+	}
+
+	std::string str() const
+	{
+		if (refs_.empty()) {
+			return buf_;
 		}
 
-		//typename std::unordered_map<BasicTypeA, BasicTypeB>::const_iterator it = a.begin();
-		////auto it = a.begin();
-		//for (;it != a.end();++it){
-		//	tempKey.emplace_back(it->first);
-		//	tempVal.emplace_back(it->second);
-		//}
+		std::vector<std::pair<const char*, size_t> > segments;
+		gather(segments);
 
-		this->operator<< (temp_key);
-		return this->operator<< (temp_val);
+		std::string ret;
+		ret.reserve(size());
+		for (const auto& seg : segments) {
+			ret.append(seg.first, seg.second);
+		}
+
+		return ret;
+	}
+
+	//不拷贝,直接访问已编码的数据,在下一次写入或reset前有效
+	//不包含按引用输出的数据块,has_references()为真时请用gather或str
+	const std::string& buffer() const
+	{
+		return buf_;
+	}
+
+	//是否有数据块按引用输出,此时buffer()不是完整的编码结果
+	bool has_references() const
+	{
+		return !refs_.empty();
+	}
+
+	//编码后的总长度,包含引用的数据块
+	size_t size() const
+	{
+		size_t total = buf_.size();
+		for (const auto& ref : refs_) {
+			total += ref.size;
+		}
+
+		return total;
+	}
+
+	//按顺序列出输出的各段:自己缓冲区中的编码数据和引用的调用者数据块
+	//可直接转换成iovec交给writev/sendmsg
+	void gather(std::vector<std::pair<const char*, size_t> >& segments) const
+	{
+		segments.clear();
+		size_t offset = 0;
+		for (const auto& ref : refs_) {
+			if (ref.offset > offset) {
+				segments.emplace_back(buf_.data() + offset, ref.offset - offset);
+			}
+
+			segments.emplace_back(ref.data, ref.size);
+			offset = ref.offset;
+		}
+
+		if (buf_.size() > offset) {
+			segments.emplace_back(buf_.data() + offset, buf_.size() - offset);
+		}
+	}
+
+	//按当前的length_mode写出长度前缀,自定义格式中的个数也应通过它写出
+	void write_length(size_t size)
+	{
+		if (length_mode_ == length_fixed32) {
+			if (size > 0xffffffffu) {
+				throw std::length_error("out_stream: length exceeds 32 bits, use length_varint");
+			}
+
+			unsigned int len = static_cast<unsigned int>(size);
+			::serialize(len, buf_);
+			return;
+		}
+
+		uint64_t n = size;
+		char tmp[10];
+		size_t i = 0;
+		while (n >= 0x80) {
+			tmp[i++] = static_cast<char>(n | 0x80);
+			n >>= 7;
+		}
+
+		tmp[i++] = static_cast<char>(n);
+		buf_.append(tmp, i);
+	}
+
+protected:
+	//count个element_size字节的元素,length_varint下按块写出
+	void write_bytes(const char* data, size_t count, size_t element_size)
+	{
+		if (length_mode_ == length_fixed32) {
+			write_length(count);
+			write_block(data, count * element_size);
+			return;
+		}
+
+		size_t per_chunk = std::max<size_t>(1, chunk_size_ / element_size);
+		for (size_t i = 0; i < count; i += per_chunk) {
+			size_t n = std::min(per_chunk, count - i);
+			write_length(n);
+			write_block(data + i * element_size, n * element_size);
+		}
+
+		write_length(0);
+	}
+
+	template<typename Container>
+	void write_sequence(Container& a, size_t size)
+	{
+		write_length(size);
+
+		for (auto& item : a) {
+			*this << item;
+		}
+	}
+
+	template<typename BasicType>
+	void write_vector(std::vector<BasicType>& a, std::false_type)
+	{
+		write_sequence(a, a.size());
+	}
+
+	//元素没有填充字节,整段拷贝
+	template<typename BasicType>
+	void write_vector(std::vector<BasicType>& a, std::true_type)
+	{
+		write_bytes(reinterpret_cast<const char*>(a.data()), a.size(), sizeof(BasicType));
 	}
 
 	template<typename BasicTypeA, typename BasicTypeB>
-	out_stream& operator<< (std::unordered_multimap<BasicTypeA, BasicTypeB>& a)
+	void write_pair(std::pair<BasicTypeA, BasicTypeB>& a, std::false_type)
 	{
-		std::vector<BasicTypeA> temp_key;
-		std::vector<BasicTypeB> temp_val;
+		*this << a.first << a.second;
+	}
 
-		for (const auto& info : a) {
-			temp_key.emplace_back(info.first);
-			temp_val.emplace_back(info.second);
+	template<typename BasicTypeA, typename BasicTypeB>
+	void write_pair(std::pair<BasicTypeA, BasicTypeB>& a, std::true_type)
+	{
+		buf_.append(reinterpret_cast<const char*>(&a), sizeof(a));
+	}
+
+	template<typename BasicType, size_t N>
+	void write_array(std::array<BasicType, N>& a, std::false_type)
+	{
+		for (auto& item : a) {
+			*this << item;
 		}
+	}
 
-		//typename std::unordered_map<BasicTypeA, BasicTypeB>::const_iterator it = a.begin();
-		////auto it = a.begin();
-		//for (;it != a.end();++it){
-		//	tempKey.emplace_back(it->first);
-		//	tempVal.emplace_back(it->second);
-		//}
+	template<typename BasicType, size_t N>
+	void write_array(std::array<BasicType, N>& a, std::true_type)
+	{
+		buf_.append(reinterpret_cast<const char*>(a.data()), sizeof(a));
+	}
 
-		this->operator<< (temp_key);
-		return this->operator<< (temp_val);
+	void write_block(const char* data, size_t size)
+	{
+		if (reference_threshold_ == 0 || size < reference_threshold_) {
+			buf_.append(data, size);
+			return;
+		}
+
+		//只记录插入位置,buf_扩容后仍然有效
+		reference ref = { buf_.size(), data, size };
+		refs_.push_back(ref);
 	}
 
-	std::string str()
+	//哈希容器:元素个数、桶数、最大负载因子,后面逐个写元素(map为key,value交替)
+	template<typename Container>
+	void write_hashed(Container& a)
 	{
-		return std::move(os_.str());
+		float max_load_factor = a.max_load_factor();
+		write_length(a.size());
+		write_length(a.bucket_count());
+		*this << max_load_factor;
+
+		for (auto& item : a) {
+			write_entry(item);
+		}
 	}
 
-public:
-	std::ostringstream os_;
+	//serialize不会修改参数,key是const只是为了匹配非const的接口
+	template<typename BasicType>
+	void write_entry(const BasicType& a)
+	{
+		*this << const_cast<BasicType&>(a);
+	}
+
+	template<typename BasicTypeA, typename BasicTypeB>
+	void write_entry(std::pair<const BasicTypeA, BasicTypeB>& a)
+	{
+		*this << const_cast<BasicTypeA&>(a.first) << a.second;
+	}
+
+	template<size_t I, typename... BasicTypes>
+	typename std::enable_if<I == sizeof...(BasicTypes)>::type write_tuple(std::tuple<BasicTypes...>&)
+	{
+	}
+
+	template<size_t I, typename... BasicTypes>
+	typename std::enable_if<I < sizeof...(BasicTypes)>::type write_tuple(std::tuple<BasicTypes...>& a)
+	{
+		*this << std::get<I>(a);
+		write_tuple<I + 1>(a);
+	}
+
+protected:
+	struct reference
+	{
+		size_t offset;
+		const char* data;
+		size_t size;
+	};
+
+protected:
+	std::string buf_;
+	buffer_pool* pool_;
+	std::vector<reference> refs_;
+	size_t reference_threshold_;
+	length_mode length_mode_;
+	size_t chunk_size_;
+};
+
+//in_stream的反序列化方式
+enum decode_mode
+{
+	decode_append,	//追加到目标容器末尾(默认)
+	decode_reuse	//覆盖目标对象,复用已有元素和字符串的容量,只裁掉多余部分
 };
 
+//哈希容器的最大负载因子来自输入数据,过小的值会导致巨大的桶数组,NaN和无穷大也不接受
+inline bool valid_load_factor(float max_load_factor)
+{
+	return max_load_factor >= 0.1f && max_load_factor <= 16.0f;
+}
+
 class in_stream
 {
 public:
-	in_stream(const std::string& s) : str_(s), total_(s.size())
+	in_stream(const std::string& s, decode_mode mode = decode_append)
+		: str_(s), data_(str_.data()), size_(str_.size()), pos_(0), mode_(mode), length_mode_(length_fixed32), pool_(nullptr)
+	{
+	}
+
+	//不拷贝,直接在调用者的缓冲区上解码,缓冲区须在解码期间有效
+	in_stream(const char* data, size_t size, decode_mode mode = decode_append)
+		: data_(data), size_(size), pos_(0), mode_(mode), length_mode_(length_fixed32), pool_(nullptr)
+	{
+	}
+
+	//输入拷贝到从pool取出的缓冲区,析构时归还
+	in_stream(buffer_pool& pool, const std::string& s, decode_mode mode = decode_append)
+		: str_(pool.acquire(s.size())), data_(nullptr), size_(0), pos_(0), mode_(mode), length_mode_(length_fixed32), pool_(&pool)
+	{
+		reset(s);
+	}
+
+	in_stream(const in_stream&) = delete;
+	in_stream& operator=(const in_stream&) = delete;
+
+	~in_stream()
+	{
+		if (pool_ != nullptr) {
+			pool_->release(std::move(str_));
+		}
+	}
+
+	//换一段输入重新解码,复用已有缓冲区
+	void reset(const std::string& s)
+	{
+		reset(s.data(), s.size());
+	}
+
+	void reset(const char* data, size_t size)
+	{
+		str_.assign(data, size);
+		data_ = str_.data();
+		size_ = str_.size();
+		pos_ = 0;
+	}
+
+	//换一段输入重新解码,不拷贝
+	void rebind(const char* data, size_t size)
 	{
+		data_ = data;
+		size_ = size;
+		pos_ = 0;
 	}
 
-	~in_stream() = default;
+	void set_mode(decode_mode mode)
+	{
+		mode_ = mode;
+	}
+
+	decode_mode mode() const
+	{
+		return mode_;
+	}
+
+	void set_length_mode(length_mode mode)
+	{
+		length_mode_ = mode;
+	}
 
 	template<typename SerializableType>
 	in_stream& operator>> (SerializableType& a)
 	{
-		int ret = ::deserialize(str_, a);
-		str_ = str_.substr(ret);
+		read(a);
+		return *this;
+	}
+
+	in_stream& operator>> (std::string& a)
+	{
+		if (length_mode_ == length_fixed32) {
+			read(a);
+			return *this;
+		}
+
+		//逐块追加,clear保留已有容量
+		a.clear();
+		for (size_t n = read_length(); n > 0; n = read_length()) {
+			if (size_ - pos_ < n) {
+				throw std::out_of_range("deserialize: string truncated");
+			}
+
+			a.append(data_ + pos_, n);
+			pos_ += n;
+		}
+
 		return *this;
 	}
 
 	template<typename BasicType>
 	in_stream& operator>> (std::vector<BasicType>& a)
 	{
-		unsigned int len = 0;
-		int ret = ::deserialize(str_, len);
-		str_ = str_.substr(ret);
+		read_vector(a, is_packed<BasicType>());
+		return *this;
+	}
 
-		for (unsigned int i = 0; i < len; ++i) {
-			BasicType item;
-			int size = ::deserialize(str_, item);
-			str_ = str_.substr(size);
-			a.emplace_back(item);
-		}
+	template<typename BasicTypeA, typename BasicTypeB>
+	in_stream& operator>> (std::pair<BasicTypeA, BasicTypeB>& a)
+	{
+		read_pair(a, is_packed<std::pair<BasicTypeA, BasicTypeB> >());
+		return *this;
+	}
+
+	template<typename BasicType, size_t N>
+	in_stream& operator>> (std::array<BasicType, N>& a)
+	{
+		read_array(a, is_packed<std::array<BasicType, N> >());
+		return *this;
+	}
 
+	template<typename... BasicTypes>
+	in_stream& operator>> (std::tuple<BasicTypes...>& a)
+	{
+		read_tuple<0>(a);
 		return *this;
 	}
 
+#ifdef SERIALIZE_HAS_CXX17
 	template<typename BasicType>
-	in_stream& operator>> (std::list<BasicType>& a)
+	in_stream& operator>> (std::optional<BasicType>& a)
 	{
-		std::vector<BasicType> temp;
-		in_stream& ret = this->operator>> (temp);
-		if (temp.size() > 0) {
-			std::copy(temp.begin(), temp.end(), std::back_inserter(a));
+		unsigned char has_value = 0;
+		*this >> has_value;
+		if (has_value == 0) {
+			a.reset();
 		}
+		else {
+			if (!a.has_value()) {
+				a.emplace();
+			}
 
-		return ret;
+			*this >> *a;
+		}
+
+		return *this;
+	}
+
+	template<typename... BasicTypes>
+	in_stream& operator>> (std::variant<BasicTypes...>& a)
+	{
+		unsigned int index = 0;
+		*this >> index;
+		if (index >= sizeof...(BasicTypes)) {
+			throw std::out_of_range("deserialize: bad variant index");
+		}
+
+		read_variant<0>(a, index);
+		return *this;
+	}
+#endif
+
+	template<typename BasicType>
+	in_stream& operator>> (std::list<BasicType>& a)
+	{
+		read_sequence(a);
+		return *this;
 	}
 
 	//c++11单链表
 	template<typename BasicType>
 	in_stream& operator>> (std::forward_list<BasicType>& a)
 	{
-		std::vector<BasicType> temp;
-		in_stream& ret = this->operator>> (temp);
-		if (temp.size() > 0) {
-			std::copy(temp.begin(), temp.end(), std::back_inserter(a));
+		size_t len = read_length();
+
+		auto prev = a.before_begin();
+		if (mode_ == decode_reuse) {
+			for (; std::next(prev) != a.end() && len > 0; ++prev, --len) {
+				*this >> *std::next(prev);
+			}
+
+			a.erase_after(prev, a.end());
 		}
+		else {
+			for (auto it = a.begin(); it != a.end(); ++it) {
+				++prev;
+			}
+		}
+
+		for (; len > 0; --len) {
+			prev = a.emplace_after(prev);
+			*this >> *prev;
+		}
+
+		return *this;
 	}
 
 	template<typename BasicType>
 	in_stream& operator>> (std::deque<BasicType>& a)
 	{
-		std::vector<BasicType> temp;
-		in_stream& ret = this->operator>> (temp);
-		if (temp.size() > 0) {
-			std::copy(temp.begin(), temp.end(), std::back_inserter(a));
-		}
-
-		return ret;
+		read_sequence(a);
+		return *this;
 	}
 
 	template<typename BasicType>
 	in_stream& operator>> (std::set<BasicType>& a)
 	{
+		reset_target(a);
 		std::vector<BasicType> temp;
 		in_stream& ret = this->operator>> (temp);
 		for (const auto& info : temp) {
@@ -352,6 +995,7 @@ public:
 	template<typename BasicType>
 	in_stream& operator>> (std::multiset<BasicType>& a)
 	{
+		reset_target(a);
 		std::vector<BasicType> temp;
 		in_stream& ret = this->operator>> (temp);
 		for (const auto& info : temp) {
@@ -361,33 +1005,24 @@ public:
 		return ret;
 	}
 
-	template<typename BasicType>
-	in_stream& operator>> (std::unordered_set<BasicType>& a)
+	template<typename BasicType, typename Hash, typename Pred, typename Alloc>
+	in_stream& operator>> (std::unordered_set<BasicType, Hash, Pred, Alloc>& a)
 	{
-		std::vector<BasicType> temp;
-		in_stream& ret = this->operator>> (temp);
-		for (const auto& info : temp) {
-			a.emplace(info);
-		}
-
-		return ret;
+		read_hashed(a);
+		return *this;
 	}
 
-	template<typename BasicType>
-	in_stream& operator>> (std::unordered_multiset<BasicType>& a)
+	template<typename BasicType, typename Hash, typename Pred, typename Alloc>
+	in_stream& operator>> (std::unordered_multiset<BasicType, Hash, Pred, Alloc>& a)
 	{
-		std::vector<BasicType> temp;
-		in_stream& ret = this->operator>> (temp);
-		for (const auto& info : temp) {
-			a.emplace(info);
-		}
-
-		return ret;
+		read_hashed(a);
+		return *this;
 	}
 
 	template<typename BasicTypeA, typename BasicTypeB>
 	in_stream& operator>> (std::map<BasicTypeA, BasicTypeB>& a)
 	{
+		reset_target(a);
 		std::vector<BasicTypeA> temp_key;
 		std::vector<BasicTypeB> temp_val;
 
@@ -408,6 +1043,7 @@ public:
 	template<typename BasicTypeA, typename BasicTypeB>
 	in_stream& operator>> (std::multimap<BasicTypeA, BasicTypeB>& a)
 	{
+		reset_target(a);
 		std::vector<BasicTypeA> temp_key;
 		std::vector<BasicTypeB> temp_val;
 
@@ -425,53 +1061,260 @@ public:
 		return ret;
 	}
 
-	template<typename BasicTypeA, typename BasicTypeB>
-	in_stream& operator>> (std::unordered_map<BasicTypeA, BasicTypeB>& a)
+	template<typename BasicTypeA, typename BasicTypeB, typename Hash, typename Pred, typename Alloc>
+	in_stream& operator>> (std::unordered_map<BasicTypeA, BasicTypeB, Hash, Pred, Alloc>& a)
 	{
-		std::vector<BasicTypeA> temp_key;
-		std::vector<BasicTypeB> temp_val;
+		read_hashed(a);
+		return *this;
+	}
 
-		this->operator>> (temp_key);
-		in_stream& ret = this->operator>> (temp_val);
+	template<typename BasicTypeA, typename BasicTypeB, typename Hash, typename Pred, typename Alloc>
+	in_stream& operator>> (std::unordered_multimap<BasicTypeA, BasicTypeB, Hash, Pred, Alloc>& a)
+	{
+		read_hashed(a);
+		return *this;
+	}
 
-		if (temp_key.size() > 0 && temp_val.size() == temp_key.size()) {
-			size_t key_size = temp_key.size();
-			for (size_t i = 0; i < key_size; ++i) {
-				//a.insert(std::make_pair<BasicTypeA, BasicTypeB>(tempKey[i], tempVal[i]));//会报错
-				a.emplace(temp_key[i], temp_val[i]);
+	//已解码的字节数
+	size_t size()
+	{
+		return pos_;
+	}
+
+	//按当前的length_mode读取长度前缀,与out_stream::write_length对应
+	size_t read_length()
+	{
+		if (length_mode_ == length_fixed32) {
+			unsigned int len = 0;
+			read(len);
+			return len;
+		}
+
+		uint64_t n = 0;
+		for (int shift = 0;; shift += 7) {
+			if (pos_ >= size_ || shift > 63) {
+				throw std::out_of_range("deserialize: bad length");
+			}
+
+			unsigned char b = static_cast<unsigned char>(data_[pos_++]);
+			n |= static_cast<uint64_t>(b & 0x7f) << shift;
+			if ((b & 0x80) == 0) {
+				break;
 			}
 		}
 
-		return ret;
+		if (n > static_cast<uint64_t>(static_cast<size_t>(-1))) {
+			throw std::length_error("deserialize: length exceeds size_t");
+		}
+
+		return static_cast<size_t>(n);
 	}
 
-	template<typename BasicTypeA, typename BasicTypeB>
-	in_stream& operator>> (std::unordered_multimap<BasicTypeA, BasicTypeB>& a)
+protected:
+	template<typename Type>
+	void read(Type& a)
 	{
-		std::vector<BasicTypeA> temp_key;
-		std::vector<BasicTypeB> temp_val;
+		pos_ += ::deserialize(data_ + pos_, size_ - pos_, a);
+	}
 
-		this->operator>> (temp_key);
-		in_stream& ret = this->operator>> (temp_val);
+	//读取长度前缀但不移动读位置
+	size_t peek_size()
+	{
+		size_t pos = pos_;
+		size_t len = read_length();
+		pos_ = pos;
+		return len;
+	}
 
-		if (temp_key.size() > 0 && temp_val.size() == temp_key.size()) {
-			size_t key_size = temp_key.size();
-			for (size_t i = 0; i < key_size; ++i) {
-				//a.insert(std::make_pair<BasicTypeA, BasicTypeB>(tempKey[i], tempVal[i]));//会报错
-				a.emplace(temp_key[i], temp_val[i]);
+	void read_block(void* a, size_t size)
+	{
+		if (size_ - pos_ < size) {
+			throw std::out_of_range("deserialize: buffer too short");
+		}
+
+		memcpy(a, data_ + pos_, size);
+		pos_ += size;
+	}
+
+	//decode_reuse模式下先按原位覆盖已有元素,再补足或裁掉多余元素
+	template<typename Container>
+	void read_sequence(Container& a)
+	{
+		size_t len = read_length();
+
+		if (mode_ == decode_reuse) {
+			auto it = a.begin();
+			for (; it != a.end() && len > 0; ++it, --len) {
+				*this >> *it;
 			}
+
+			a.erase(it, a.end());
 		}
 
-		return ret;
+		for (; len > 0; --len) {
+			a.emplace_back();
+			*this >> a.back();
+		}
 	}
 
-	unsigned int size()
+	template<typename BasicType>
+	void read_vector(std::vector<BasicType>& a, std::false_type)
+	{
+		//每个元素至少占一个字节,防止错误的长度导致超大的预留
+		size_t len = std::min(peek_size(), size_ - pos_);
+		if (mode_ == decode_reuse || a.empty()) {
+			a.reserve(len);
+		}
+
+		read_sequence(a);
+	}
+
+	//元素没有填充字节,整段拷贝
+	template<typename BasicType>
+	void read_vector(std::vector<BasicType>& a, std::true_type)
+	{
+		size_t base = mode_ == decode_reuse ? 0 : a.size();
+		a.resize(base);
+
+		//length_fixed32只有一块,length_varint以0长度的块结束
+		size_t len = read_length();
+		for (;;) {
+			if ((size_ - pos_) / sizeof(BasicType) < len) {
+				throw std::out_of_range("deserialize: vector truncated");
+			}
+
+			a.resize(base + len);
+			if (len > 0) {
+				read_block(a.data() + base, len * sizeof(BasicType));
+			}
+
+			base += len;
+			if (length_mode_ == length_fixed32 || len == 0) {
+				break;
+			}
+
+			len = read_length();
+		}
+	}
+
+	template<typename BasicTypeA, typename BasicTypeB>
+	void read_pair(std::pair<BasicTypeA, BasicTypeB>& a, std::false_type)
+	{
+		*this >> a.first >> a.second;
+	}
+
+	template<typename BasicTypeA, typename BasicTypeB>
+	void read_pair(std::pair<BasicTypeA, BasicTypeB>& a, std::true_type)
+	{
+		read_block(&a, sizeof(a));
+	}
+
+	template<typename BasicType, size_t N>
+	void read_array(std::array<BasicType, N>& a, std::false_type)
+	{
+		for (auto& item : a) {
+			*this >> item;
+		}
+	}
+
+	template<typename BasicType, size_t N>
+	void read_array(std::array<BasicType, N>& a, std::true_type)
 	{
-		return static_cast<unsigned int>(total_ - str_.size());
+		read_block(a.data(), sizeof(a));
 	}
+
+	//先按发送方的布局预留好桶,再逐个移动插入,避免解码过程中反复rehash
+	template<typename Container>
+	void read_hashed(Container& a)
+	{
+		size_t len = read_length();
+		size_t bucket_count = read_length();
+		float max_load_factor = 0;
+		*this >> max_load_factor;
+
+		//追加到非空容器时保留调用者设置的负载因子
+		reset_target(a);
+		if (a.empty() && valid_load_factor(max_load_factor)) {
+			a.max_load_factor(max_load_factor);
+		}
+
+		//每个元素至少占一个字节,防止错误的长度导致超大的预留
+		size_t count = std::min<size_t>(len, size_ - pos_);
+		a.reserve(a.size() + count);
+		if (bucket_count > a.bucket_count() && bucket_count <= count * 4 + 16) {
+			a.rehash(bucket_count);
+		}
+
+		for (; len > 0; --len) {
+			read_entry(a, static_cast<typename Container::value_type*>(nullptr));
+		}
+	}
+
+	template<typename Container, typename BasicType>
+	void read_entry(Container& a, BasicType*)
+	{
+		BasicType item;
+		*this >> item;
+		a.emplace(std::move(item));
+	}
+
+	template<typename Container, typename BasicTypeA, typename BasicTypeB>
+	void read_entry(Container& a, std::pair<const BasicTypeA, BasicTypeB>*)
+	{
+		BasicTypeA key;
+		BasicTypeB val;
+		*this >> key >> val;
+		a.emplace(std::move(key), std::move(val));
+	}
+
+	template<size_t I, typename... BasicTypes>
+	typename std::enable_if<I == sizeof...(BasicTypes)>::type read_tuple(std::tuple<BasicTypes...>&)
+	{
+	}
+
+	template<size_t I, typename... BasicTypes>
+	typename std::enable_if<I < sizeof...(BasicTypes)>::type read_tuple(std::tuple<BasicTypes...>& a)
+	{
+		*this >> std::get<I>(a);
+		read_tuple<I + 1>(a);
+	}
+
+#ifdef SERIALIZE_HAS_CXX17
+	//按运行时下标构造对应的类型,已是该类型时原位覆盖
+	template<size_t I, typename... BasicTypes>
+	void read_variant(std::variant<BasicTypes...>& a, unsigned int index)
+	{
+		if constexpr (I < sizeof...(BasicTypes)) {
+			if (index != I) {
+				read_variant<I + 1>(a, index);
+				return;
+			}
+
+			if (a.index() != I) {
+				a.template emplace<I>();
+			}
+
+			*this >> std::get<I>(a);
+		}
+	}
+#endif
+
+	template<typename Container>
+	void reset_target(Container& a)
+	{
+		if (mode_ == decode_reuse) {
+			a.clear();
+		}
+	}
+
 protected:
 	std::string str_;
-	size_t total_;
+	const char* data_;
+	size_t size_;
+	size_t pos_;
+	decode_mode mode_;
+	length_mode length_mode_;
+	buffer_pool* pool_;
 };
 
 ///////////////////////////////////////////
@@ -0,0 +1,330 @@
+#ifndef _SHM_RING_HEADER_H_
+#define _SHM_RING_HEADER_H_
+#include "serialize.h"
+#include <cstring>
+#include <atomic>
+#include <new>
+#include <system_error>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+////////////////////////////////////////////////////
+//single-producer/single-consumer ring in POSIX shared
+//memory, for passing out_stream messages between two
+//processes on one Linux machine
+//
+//The segment holds a header and slot_count fixed size
+//slots, each one a 4 byte length and the payload.
+//The producer copies the encoded message into the next
+//free slot and the consumer decodes it in place with
+//in_stream(data,size), so the only copy is the one from
+//the out_stream buffer into the slot.
+//
+//A side that finds the ring empty or full spins for a
+//while, then sleeps on a futex in the segment.
+////////////////////////////////////////////////////
+
+class shm_ring
+{
+public:
+	//创建新的共享内存段,slot_size包含4字节的长度
+	shm_ring(const std::string& name, size_t slot_size, size_t slot_count)
+		: name_(name), header_(nullptr), slots_(nullptr), map_size_(0), slot_size_(slot_size), slot_count_(slot_count),
+		spin_count_(4096), owner_(true)
+	{
+		if (slot_size <= sizeof(uint32_t) || slot_size % sizeof(uint32_t) != 0 || slot_size > 0xffffffffu
+			|| slot_count == 0 || slot_count > 0xffffffffu) {
+			throw std::invalid_argument("shm_ring: bad slot layout");
+		}
+
+		int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+		if (fd < 0) {
+			throw std::system_error(errno, std::generic_category(), "shm_open");
+		}
+
+		map_size_ = sizeof(header) + slot_size * slot_count;
+		if (::ftruncate(fd, static_cast<off_t>(map_size_)) != 0) {
+			int err = errno;
+			::close(fd);
+			::shm_unlink(name.c_str());
+			throw std::system_error(err, std::generic_category(), "ftruncate");
+		}
+
+		map(fd);
+		new (header_) header();
+		header_->slot_size = static_cast<uint32_t>(slot_size);
+		header_->slot_count = static_cast<uint32_t>(slot_count);
+		header_->magic.store(magic_value, std::memory_order_release);
+	}
+
+	//打开已有的共享内存段
+	explicit shm_ring(const std::string& name)
+		: name_(name), header_(nullptr), slots_(nullptr), map_size_(0), slot_size_(0), slot_count_(0),
+		spin_count_(4096), owner_(false)
+	{
+		int fd = ::shm_open(name.c_str(), O_RDWR, 0600);
+		if (fd < 0) {
+			throw std::system_error(errno, std::generic_category(), "shm_open");
+		}
+
+		struct stat st;
+		if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(header)) {
+			::close(fd);
+			throw std::runtime_error("shm_ring: segment not initialized");
+		}
+
+		map_size_ = static_cast<size_t>(st.st_size);
+		map(fd);
+		if (header_->magic.load(std::memory_order_acquire) != magic_value) {
+			::munmap(header_, map_size_);
+			throw std::runtime_error("shm_ring: segment not initialized");
+		}
+
+		//布局只在打开时校验一次并保存在本地,之后不再信任共享内存中的字段
+		slot_size_ = header_->slot_size;
+		slot_count_ = header_->slot_count;
+		if (slot_size_ <= sizeof(uint32_t) || slot_count_ == 0
+			|| (map_size_ - sizeof(header)) / slot_size_ < slot_count_) {
+			::munmap(header_, map_size_);
+			throw std::runtime_error("shm_ring: bad segment layout");
+		}
+	}
+
+	shm_ring(const shm_ring&) = delete;
+	shm_ring& operator=(const shm_ring&) = delete;
+
+	~shm_ring()
+	{
+		::munmap(header_, map_size_);
+		if (owner_) {
+			::shm_unlink(name_.c_str());
+		}
+	}
+
+	//单条消息最大长度
+	size_t capacity() const
+	{
+		return slot_size_ - sizeof(uint32_t);
+	}
+
+	//////////////////////////////////////
+	//producer side
+	//////////////////////////////////////
+
+	bool try_push(const char* data, size_t size)
+	{
+		segment seg(data, size);
+		return try_push(&seg, 1);
+	}
+
+	void push(const char* data, size_t size)
+	{
+		segment seg(data, size);
+		push(&seg, 1);
+	}
+
+	//引用的数据块按gather列出的各段直接拷进槽里
+	void push(const out_stream& os)
+	{
+		if (!os.has_references()) {
+			push(os.buffer().data(), os.buffer().size());
+			return;
+		}
+
+		std::vector<segment> segments;
+		os.gather(segments);
+		push(segments.data(), segments.size());
+	}
+
+	//////////////////////////////////////
+	//consumer side
+	//////////////////////////////////////
+
+	//取队头消息,数据留在槽里直到pop
+	bool try_front(const char*& data, size_t& size)
+	{
+		uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+		if (header_->head.load(std::memory_order_acquire) == tail) {
+			return false;
+		}
+
+		const char* slot = slot_at(tail);
+		uint32_t len;
+		memcpy(&len, slot, sizeof(len));
+		if (len > capacity()) {
+			throw std::runtime_error("shm_ring: corrupt message length");
+		}
+
+		data = slot + sizeof(len);
+		size = len;
+		return true;
+	}
+
+	void front(const char*& data, size_t& size)
+	{
+		while (!try_front(data, size)) {
+			wait(header_->data_signal, header_->consumer_waiting, [this]() {
+				return header_->head.load(std::memory_order_acquire) != header_->tail.load(std::memory_order_relaxed);
+			});
+		}
+	}
+
+	//释放队头的槽
+	void pop()
+	{
+		header_->tail.store(header_->tail.load(std::memory_order_relaxed) + 1, std::memory_order_seq_cst);
+		notify(header_->space_signal, header_->producer_waiting);
+	}
+
+	//等待下一条消息,在槽内原位解码到a
+	template<typename Type>
+	void pop(Type& a, decode_mode mode = decode_append)
+	{
+		const char* data = nullptr;
+		size_t size = 0;
+		front(data, size);
+		in_stream is(data, size, mode);
+		is >> a;
+		pop();
+	}
+
+	void set_spin_count(unsigned int spin_count)
+	{
+		spin_count_ = spin_count;
+	}
+
+private:
+	static const uint32_t magic_value = 0x53524e47;
+
+	typedef std::pair<const char*, size_t> segment;
+
+	//head和tail分开放在不同的cache line,避免伪共享
+	struct header
+	{
+		std::atomic<uint32_t> magic;
+		uint32_t slot_size;
+		uint32_t slot_count;
+		alignas(64) std::atomic<uint64_t> head;
+		alignas(64) std::atomic<uint64_t> tail;
+		alignas(64) std::atomic<uint32_t> data_signal;
+		std::atomic<uint32_t> consumer_waiting;
+		std::atomic<uint32_t> space_signal;
+		std::atomic<uint32_t> producer_waiting;
+
+		header() : magic(0), slot_size(0), slot_count(0), head(0), tail(0),
+			data_signal(0), consumer_waiting(0), space_signal(0), producer_waiting(0)
+		{
+		}
+	};
+
+	//把count段数据拼成一条消息写入下一个槽
+	bool try_push(const segment* segments, size_t count)
+	{
+		size_t size = 0;
+		for (size_t i = 0; i < count; ++i) {
+			size += segments[i].second;
+		}
+
+		if (size > capacity()) {
+			throw std::length_error("shm_ring: message larger than slot");
+		}
+
+		uint64_t head = header_->head.load(std::memory_order_relaxed);
+		if (head - header_->tail.load(std::memory_order_acquire) == slot_count_) {
+			return false;
+		}
+
+		char* slot = slot_at(head);
+		uint32_t len = static_cast<uint32_t>(size);
+		memcpy(slot, &len, sizeof(len));
+		char* dst = slot + sizeof(len);
+		for (size_t i = 0; i < count; ++i) {
+			memcpy(dst, segments[i].first, segments[i].second);
+			dst += segments[i].second;
+		}
+
+		header_->head.store(head + 1, std::memory_order_seq_cst);
+		notify(header_->data_signal, header_->consumer_waiting);
+		return true;
+	}
+
+	void push(const segment* segments, size_t count)
+	{
+		while (!try_push(segments, count)) {
+			wait(header_->space_signal, header_->producer_waiting, [this]() {
+				return header_->head.load(std::memory_order_relaxed) - header_->tail.load(std::memory_order_acquire) < slot_count_;
+			});
+		}
+	}
+
+	void map(int fd)
+	{
+		void* addr = ::mmap(nullptr, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		int err = errno;
+		::close(fd);
+		if (addr == MAP_FAILED) {
+			if (owner_) {
+				::shm_unlink(name_.c_str());
+			}
+
+			throw std::system_error(err, std::generic_category(), "mmap");
+		}
+
+		header_ = static_cast<header*>(addr);
+		slots_ = static_cast<char*>(addr) + sizeof(header);
+	}
+
+	char* slot_at(uint64_t index) const
+	{
+		return slots_ + static_cast<size_t>(index % slot_count_) * slot_size_;
+	}
+
+	//先自旋,仍不满足时登记等待并在futex上睡眠
+	//waiting与head/tail都是seq_cst,对端要么看到waiting,要么本端复查时看到新的head/tail
+	template<typename Ready>
+	void wait(std::atomic<uint32_t>& signal, std::atomic<uint32_t>& waiting, Ready ready)
+	{
+		for (unsigned int i = 0; i < spin_count_; ++i) {
+			if (ready()) {
+				return;
+			}
+		}
+
+		uint32_t seq = signal.load(std::memory_order_seq_cst);
+		waiting.store(1, std::memory_order_seq_cst);
+		if (!ready()) {
+			//超时只是保险,防止对端进程退出后永远睡眠
+			struct timespec timeout = { 0, 100 * 1000 * 1000 };
+			::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&signal), FUTEX_WAIT, seq, &timeout, nullptr, 0);
+		}
+
+		waiting.store(0, std::memory_order_relaxed);
+	}
+
+	static void notify(std::atomic<uint32_t>& signal, std::atomic<uint32_t>& waiting)
+	{
+		if (waiting.load(std::memory_order_seq_cst) != 0) {
+			signal.fetch_add(1, std::memory_order_seq_cst);
+			::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&signal), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+		}
+	}
+
+private:
+	std::string name_;
+	header* header_;
+	char* slots_;
+	size_t map_size_;
+	size_t slot_size_;
+	uint64_t slot_count_;
+	unsigned int spin_count_;
+	bool owner_;
+};
+
+#endif
@@ -1,7 +1,40 @@
 #include "serialize.h"
+#include "resumable_stream.h"
+#include "delta_stream.h"
+#include "shm_ring.h"
+#include "record_log.h"
+#include "gather_io.h"
+#include "concurrent_log.h"
+#include <thread>
 #include "testlib/lut.h"
 #include <string.h>
 #include <iostream>
+#include <sys/wait.h>
+#include <new>
+
+//统计当前线程的堆分配次数,用来检查复用缓冲区的路径不再分配
+static thread_local size_t allocation_count = 0;
+
+void *operator new(size_t size)
+{
+    ++allocation_count;
+    void *p = malloc(size == 0 ? 1 : size);
+    if (p == NULL)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
 
 class MyTest : public Serializable
 {
@@ -52,14 +85,14 @@ public:
 
     virtual std::string serialize()
     {
-        OutStream os;
+        out_stream os;
         os << m_name << m_age << m_salary;
         return os.str();
     }
 
-    virtual int deserialize(std::string &str)
+    virtual unsigned int deserialize(const std::string &str)
     {
-        InStream is(str);
+        in_stream is(str);
         is >> m_name >> m_age>>m_salary;
         return is.size();
     }
@@ -88,7 +121,7 @@ TEST(Serialize, BasicType)
     float d = 4;
     long long e = 5;
 
-    OutStream os;
+    out_stream os;
     os << x << a << b << c << d << e;
 
     std::string serializestr = os.str();
@@ -100,7 +133,7 @@ TEST(Serialize, BasicType)
     float d1;
     long long e1;
 
-    InStream is(serializestr);
+    in_stream is(serializestr);
     is >> x1 >> a1 >> b1 >> c1 >> d1 >> e1;
 
     ASSERT_EQ(x, x1);
@@ -115,14 +148,14 @@ TEST(Serialize, String)
 {
     std::string f = "hello";
 
-    OutStream os;
+    out_stream os;
     os << f;
 
     std::string serializestr = os.str();
 
     std::string f1;
 
-    InStream is(serializestr);
+    in_stream is(serializestr);
     is >>f1;
 
     ASSERT_EQ(f, f1);
@@ -133,14 +166,14 @@ TEST(Serialize, ClassObject)
 {
     MyTest t("zhang", 23, 3200.2);
 
-    OutStream os;
+    out_stream os;
     os << t;
 
     std::string serializestr = os.str();
 
     MyTest t1;
 
-    InStream is(serializestr);
+    in_stream is(serializestr);
     is >> t1;
 
     //t.display( );
@@ -155,13 +188,13 @@ TEST(Serialize, ContainerVector)
     n.push_back(MyTest("bbb", 222, 333));
     n.push_back(MyTest("ccc", 333, 444));
 
-    OutStream os;
+    out_stream os;
     os << n;
     std::string serializestr = os.str();
 
     std::vector<MyTest> n1;
 
-    InStream is(serializestr);
+    in_stream is(serializestr);
     is >> n1;
 
     ASSERT_EQ(n.size(), n1.size());
@@ -179,13 +212,13 @@ TEST(Serialize, ContainerList)
     strarr.push_back("world");
     strarr.push_back("hello");
 
-    OutStream os;
+    out_stream os;
     os << strarr;
 
     std::string codestr = os.str();
 
     std::list<std::string> newstrarr;
-    InStream is(codestr);
+    in_stream is(codestr);
     is>>newstrarr;
 
     ASSERT_EQ(strarr.size(), newstrarr.size());
@@ -204,13 +237,13 @@ TEST(Serialize, ContainerSet)
     strarr.insert("world");
     strarr.insert("hello");
 
-    OutStream os;
+    out_stream os;
     os << strarr;
 
     std::string codestr = os.str();
 
     std::set<std::string> newstrarr;
-    InStream is(codestr);
+    in_stream is(codestr);
     is>>newstrarr;
 
     ASSERT_EQ(strarr.size(), newstrarr.size());
@@ -229,13 +262,13 @@ TEST(Serialize, ContainerMap)
     themap["third"] = 3;
     themap["fourth"] = 4;
 
-    OutStream os;
+    out_stream os;
     os << themap;
 
     std::string codestr = os.str();
 
     std::map<std::string, int> newmap;
-    InStream is(codestr);
+    in_stream is(codestr);
     is>>newmap;
 
     ASSERT_EQ(themap.size(), newmap.size());
@@ -247,6 +280,889 @@ TEST(Serialize, ContainerMap)
     }
 }
 
+TEST(Serialize, DecodeReuse)
+{
+    std::vector<std::string> strarr;
+    strarr.push_back("hello world, long enough to live on the heap");
+    strarr.push_back("second");
+    strarr.push_back("third");
+
+    out_stream os;
+    os << strarr;
+    std::string codestr = os.str();
+
+    std::vector<std::string> newstrarr;
+    in_stream is(codestr, decode_reuse);
+    is >> newstrarr;
+    ASSERT_TRUE(strarr == newstrarr);
+
+    const char *first = newstrarr[0].data();
+    const std::string *items = newstrarr.data();
+
+    in_stream again(codestr, decode_reuse);
+    again >> newstrarr;
+    ASSERT_TRUE(strarr == newstrarr);
+    ASSERT_TRUE(items == newstrarr.data());
+    ASSERT_TRUE(first == newstrarr[0].data());
+
+    strarr.pop_back();
+    out_stream shorter;
+    shorter << strarr;
+    in_stream trimmed(shorter.str(), decode_reuse);
+    trimmed >> newstrarr;
+    ASSERT_TRUE(strarr == newstrarr);
+    ASSERT_TRUE(items == newstrarr.data());
+
+    in_stream append(codestr);
+    std::vector<std::string> appended(1, "zero");
+    append >> appended;
+    ASSERT_EQ(appended.size(), 4u);
+    ASSERT_EQ(appended[0], "zero");
+
+    //不拷贝输入的构造和rebind,稳态解码不分配内存
+    in_stream view(codestr.data(), codestr.size(), decode_reuse);
+    view >> newstrarr;
+    size_t before = allocation_count;
+    for (int i = 0; i < 100; ++i)
+    {
+        in_stream each(codestr.data(), codestr.size(), decode_reuse);
+        each >> newstrarr;
+
+        view.rebind(codestr.data(), codestr.size());
+        view >> newstrarr;
+    }
+    ASSERT_EQ(allocation_count - before, 0u);
+    ASSERT_TRUE(newstrarr.size() == 3 && newstrarr[2] == "third");
+}
+
+TEST(Serialize, StreamReset)
+{
+    std::string payload(1000, 'x');
+    buffer_pool pool;
+
+    const char *encoded = NULL;
+    {
+        out_stream os(pool);
+        os << payload;
+        encoded = os.buffer().data();
+
+        os.reset();
+        ASSERT_TRUE(os.buffer().empty());
+        os << payload;
+        ASSERT_TRUE(encoded == os.buffer().data());
+    }
+
+    out_stream os(pool);
+    ASSERT_TRUE(encoded == os.buffer().data());
+    os << payload;
+    std::string codestr = os.str();
+
+    std::string decoded;
+    in_stream is(pool, codestr);
+    is >> decoded;
+    ASSERT_EQ(payload, decoded);
+
+    is.reset(codestr);
+    decoded.clear();
+    is >> decoded;
+    ASSERT_EQ(payload, decoded);
+    ASSERT_EQ(is.size(), codestr.size());
+}
+
+TEST(Serialize, BufferPoolReuse)
+{
+    std::string payload(1000, 'x');
+    std::string decoded;
+    decoded.reserve(payload.size());
+    buffer_pool pool;
+
+    std::string codestr;
+    {
+        out_stream os(pool, 1000);
+        os << payload;
+        codestr = os.str();
+
+        in_stream is(pool, codestr);
+        is >> decoded;
+    }
+
+    //预热之后编码和解码都从池中取缓冲区
+    size_t before = allocation_count;
+    for (int i = 0; i < 100; ++i)
+    {
+        out_stream os(pool, 1000);
+        os << payload;
+
+        in_stream is(pool, codestr, decode_reuse);
+        is >> decoded;
+    }
+    ASSERT_EQ(allocation_count - before, 0u);
+    ASSERT_EQ(payload, decoded);
+}
+
+TEST(Serialize, ResumableDecode)
+{
+    int a = 42;
+    std::string big(100000, 'z');
+    std::vector<std::string> strarr;
+    strarr.push_back("hello");
+    strarr.push_back(std::string(3000, 'w'));
+    std::map<std::string, double> themap;
+    themap["first"] = 1.5;
+    themap["second"] = 2.5;
+    std::set<int> theset;
+    theset.insert(3);
+    theset.insert(1);
+
+    out_stream os;
+    os << a << big << strarr << themap << theset;
+    std::string codestr = os.str() + "tail";
+
+    for (int round = 0; round < 20; ++round)
+    {
+        int a1 = 0;
+        std::string big1;
+        std::vector<std::string> strarr1;
+        std::map<std::string, double> themap1;
+        std::set<int> theset1;
+
+        resumable_in_stream is;
+        is >> a1 >> big1 >> strarr1 >> themap1 >> theset1;
+
+        size_t pos = 0;
+        while (!is.done())
+        {
+            ASSERT_LT(pos, codestr.size());
+            size_t slice = std::min<size_t>(codestr.size() - pos, 1 + rand() % (round == 0 ? 3 : 5000));
+            pos += is.feed(codestr.data() + pos, slice);
+        }
+
+        ASSERT_EQ(is.size(), codestr.size() - 4);
+        ASSERT_EQ(pos, codestr.size() - 4);
+        ASSERT_EQ(a, a1);
+        ASSERT_TRUE(big == big1);
+        ASSERT_TRUE(strarr == strarr1);
+        ASSERT_TRUE(themap == themap1);
+        ASSERT_TRUE(theset == theset1);
+    }
+
+    //错误的长度不能在数据到达前触发巨大的内存分配
+    std::string corrupt;
+    resumable_in_stream bad;
+    bad >> corrupt;
+    bad.feed("\xf0\xff\xff\xff" "abc", 7);
+    ASSERT_TRUE(!bad.done());
+    ASSERT_LT(corrupt.capacity(), 4096u);
+}
+
+TEST(Serialize, DeltaMap)
+{
+    std::map<std::string, int> prev;
+    prev["first"] = 1;
+    prev["second"] = 2;
+    prev["third"] = 3;
+
+    std::map<std::string, int> curr = prev;
+    curr["second"] = 20;
+    curr["fourth"] = 4;
+    curr.erase("third");
+
+    out_stream os;
+    write_delta(os, prev, curr);
+
+    std::map<std::string, int> replica = prev;
+    in_stream is(os.str());
+    apply_delta(is, replica);
+    ASSERT_TRUE(replica == curr);
+    ASSERT_EQ(is.size(), os.str().size());
+
+    tracked_map<std::unordered_map<int, std::string> > tracked;
+    tracked[1] = "one";
+    tracked[2] = "two";
+    tracked[3] = "three";
+    std::unordered_map<int, std::string> follower;
+
+    out_stream full;
+    write_delta(full, tracked);
+    in_stream fullis(full.str());
+    apply_delta(fullis, follower);
+    ASSERT_TRUE(follower == tracked.data());
+
+    tracked[2] = "TWO";
+    tracked.erase(3);
+    tracked[5] = "five";
+    out_stream patch;
+    write_delta(patch, tracked);
+    ASSERT_TRUE(tracked.upserted().empty());
+
+    in_stream patchis(patch.str());
+    apply_delta(patchis, follower);
+    ASSERT_TRUE(follower == tracked.data());
+
+    //个数与其它长度一样使用变长编码
+    out_stream varint;
+    varint.set_length_mode(length_varint);
+    write_delta(varint, prev, curr);
+    ASSERT_LT(varint.size(), os.size());
+
+    replica = prev;
+    in_stream varintis(varint.str());
+    varintis.set_length_mode(length_varint);
+    apply_delta(varintis, replica);
+    ASSERT_TRUE(replica == curr);
+    ASSERT_EQ(varintis.size(), varint.size());
+}
+
+TEST(Serialize, NestedTypes)
+{
+    std::vector<std::vector<int> > matrix(3, std::vector<int>(4, 7));
+    matrix[1].push_back(8);
+    std::pair<int, double> pd(1, 2.5);
+    std::pair<int, float> pf(3, 4.5f);
+    std::array<float, 16> arr;
+    arr.fill(1.25f);
+    std::tuple<int, std::string, std::vector<short> > tup(5, "tuple", std::vector<short>(2, 9));
+    std::map<std::string, std::vector<int> > themap;
+    themap["first"] = std::vector<int>(3, 1);
+    themap["second"] = std::vector<int>();
+
+    out_stream os;
+    os << matrix << pd << pf << arr << tup << themap;
+    std::string codestr = os.str();
+
+    //按一个字节对齐,pair<int,double>不能整块拷贝
+    typedef std::pair<int, double> int_double;
+    typedef std::array<float, 16> float16;
+    ASSERT_EQ(packed_size<int_double>::value, 12u);
+    ASSERT_TRUE(!is_packed<int_double>::value);
+    ASSERT_TRUE(is_packed<float16>::value);
+
+    std::vector<std::vector<int> > matrix1;
+    std::pair<int, double> pd1;
+    std::pair<int, float> pf1;
+    std::array<float, 16> arr1;
+    std::tuple<int, std::string, std::vector<short> > tup1;
+    std::map<std::string, std::vector<int> > themap1;
+
+    in_stream is(codestr);
+    is >> matrix1 >> pd1 >> pf1 >> arr1 >> tup1 >> themap1;
+
+    ASSERT_TRUE(matrix == matrix1);
+    ASSERT_TRUE(pd == pd1);
+    ASSERT_TRUE(pf == pf1);
+    ASSERT_TRUE(arr == arr1);
+    ASSERT_TRUE(tup == tup1);
+    ASSERT_TRUE(themap == themap1);
+    ASSERT_EQ(is.size(), codestr.size());
+
+    //逐字节喂给resumable_in_stream
+    std::vector<std::pair<int, float> > pairs(5, std::pair<int, float>(6, 7.5f));
+    std::array<std::string, 2> names = {{ "left", "right" }};
+    std::pair<std::string, int> named("named", 8);
+    out_stream more;
+    more << pairs << names << named;
+    codestr += more.str();
+
+    std::vector<std::vector<int> > matrix2;
+    std::pair<int, double> pd2;
+    std::pair<int, float> pf2;
+    std::array<float, 16> arr2;
+    std::tuple<int, std::string, std::vector<short> > tup2;
+    std::map<std::string, std::vector<int> > themap2;
+    std::vector<std::pair<int, float> > pairs2;
+    std::array<std::string, 2> names2;
+    std::pair<std::string, int> named2;
+
+    resumable_in_stream fed;
+    fed >> matrix2 >> pd2 >> pf2 >> arr2 >> tup2 >> themap2 >> pairs2 >> names2 >> named2;
+    for (size_t pos = 0; pos < codestr.size(); ++pos)
+    {
+        fed.feed(codestr.data() + pos, 1);
+    }
+
+    ASSERT_TRUE(fed.done());
+    ASSERT_TRUE(matrix == matrix2);
+    ASSERT_TRUE(pd == pd2);
+    ASSERT_TRUE(pf == pf2);
+    ASSERT_TRUE(arr == arr2);
+    ASSERT_TRUE(tup == tup2);
+    ASSERT_TRUE(themap == themap2);
+    ASSERT_TRUE(pairs == pairs2);
+    ASSERT_TRUE(names == names2);
+    ASSERT_TRUE(named == named2);
+
+#ifdef SERIALIZE_HAS_CXX17
+    std::optional<std::string> some("value");
+    std::optional<int> none;
+    std::variant<int, std::string> var(std::string("variant"));
+
+    out_stream os17;
+    os17 << some << none << var;
+
+    std::optional<std::string> some1;
+    std::optional<int> none1(3);
+    std::variant<int, std::string> var1;
+
+    in_stream is17(os17.str());
+    is17 >> some1 >> none1 >> var1;
+    ASSERT_TRUE(some == some1);
+    ASSERT_TRUE(!none1.has_value());
+    ASSERT_TRUE(var == var1);
+
+    std::string codestr17 = os17.str();
+    std::optional<std::string> some2;
+    std::optional<int> none2(3);
+    std::variant<int, std::string> var2;
+    resumable_in_stream fed17;
+    fed17 >> some2 >> none2 >> var2;
+    for (size_t pos = 0; pos < codestr17.size(); ++pos)
+    {
+        fed17.feed(codestr17.data() + pos, 1);
+    }
+
+    ASSERT_TRUE(fed17.done());
+    ASSERT_TRUE(some == some2);
+    ASSERT_TRUE(!none2.has_value());
+    ASSERT_TRUE(var == var2);
+#endif
+}
+
+TEST(Serialize, ContainerUnorderedMap)
+{
+    std::unordered_map<std::string, int> themap;
+    themap.max_load_factor(0.5f);
+    for (int i = 0; i < 1000; ++i)
+    {
+        themap[std::to_string(i)] = i;
+    }
+
+    std::unordered_set<int> theset;
+    theset.insert(1);
+    theset.insert(2);
+
+    out_stream os;
+    os << themap << theset;
+    std::string codestr = os.str();
+
+    std::unordered_map<std::string, int> newmap;
+    std::unordered_set<int> newset;
+    in_stream is(codestr);
+    is >> newmap >> newset;
+
+    ASSERT_TRUE(themap == newmap);
+    ASSERT_TRUE(theset == newset);
+    ASSERT_EQ(newmap.max_load_factor(), 0.5f);
+    ASSERT_GE(newmap.bucket_count(), themap.bucket_count());
+    ASSERT_EQ(is.size(), codestr.size());
+
+    std::unordered_map<std::string, int> fedmap;
+    std::unordered_set<int> fedset;
+    resumable_in_stream fed;
+    fed >> fedmap >> fedset;
+    for (size_t pos = 0; pos < codestr.size(); pos += 7)
+    {
+        fed.feed(codestr.data() + pos, std::min<size_t>(7, codestr.size() - pos));
+    }
+
+    ASSERT_TRUE(fed.done());
+    ASSERT_TRUE(themap == fedmap);
+    ASSERT_TRUE(theset == fedset);
+    ASSERT_GE(fedmap.bucket_count(), themap.bucket_count());
+
+    //错误的元素个数和桶数不能在数据到达前触发巨大的内存分配
+    std::unordered_set<int> badset;
+    resumable_in_stream bad;
+    bad >> badset;
+    bad.feed("\xf0\xff\xff\xff" "\xf0\xff\xff\xff" "\0\0\x80\x3f", 12);
+    ASSERT_TRUE(!bad.done());
+    ASSERT_LT(badset.bucket_count(), 4096u);
+
+    //不合理的负载因子不采用,追加到非空容器时保留原来的负载因子
+    std::unordered_set<int> bigset;
+    for (int i = 0; i < 1000; ++i)
+    {
+        bigset.insert(i);
+    }
+
+    out_stream bigos;
+    bigos << bigset;
+    std::string patched = bigos.str();
+    float tiny = 1e-30f;
+    memcpy(&patched[8], &tiny, sizeof(tiny));
+
+    std::unordered_set<int> tinyset;
+    in_stream tinyis(patched);
+    tinyis >> tinyset;
+    ASSERT_TRUE(tinyset == bigset);
+    ASSERT_EQ(tinyset.max_load_factor(), 1.0f);
+    ASSERT_LT(tinyset.bucket_count(), 100000u);
+
+    std::unordered_set<int> fedtiny;
+    resumable_in_stream tinyfed;
+    tinyfed >> fedtiny;
+    tinyfed.feed(patched);
+    ASSERT_TRUE(fedtiny == bigset);
+    ASSERT_LT(fedtiny.bucket_count(), 100000u);
+
+    std::unordered_set<int> target;
+    target.max_load_factor(0.75f);
+    target.insert(-1);
+    in_stream appendis(bigos.str());
+    appendis >> target;
+    ASSERT_EQ(target.size(), 1001u);
+    ASSERT_EQ(target.max_load_factor(), 0.75f);
+}
+
+TEST(Serialize, ShmRing)
+{
+    std::string name = "/serialize_test_" + std::to_string(getpid());
+    const int count = 200000;
+    shm_ring ring(name, 256, 64);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        shm_ring producer(name);
+        out_stream os;
+        for (int i = 0; i < count; ++i)
+        {
+            std::vector<int> msg(1 + i % 16, i);
+            os.reset();
+            os << msg;
+            producer.push(os);
+        }
+
+        _exit(0);
+    }
+
+    std::vector<int> msg;
+    for (int i = 0; i < count; ++i)
+    {
+        ring.pop(msg, decode_reuse);
+        ASSERT_EQ(msg.size(), 1u + i % 16);
+        ASSERT_EQ(msg.back(), i);
+    }
+
+    int status = -1;
+    waitpid(pid, &status, 0);
+    ASSERT_EQ(status, 0);
+
+    //共享内存中错误的消息长度不能导致越界读
+    ring.push("abc", 3);
+    int fd = shm_open(name.c_str(), O_RDWR, 0600);
+    struct stat st;
+    fstat(fd, &st);
+    char *segment = (char *)mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    size_t slots = st.st_size - 256 * 64;
+    uint32_t bad = 0xffffffff;
+    memcpy(segment + slots + (count % 64) * 256, &bad, sizeof(bad));
+    munmap(segment, st.st_size);
+
+    const char *data = nullptr;
+    size_t size = 0;
+    bool thrown = false;
+    try
+    {
+        ring.try_front(data, size);
+    }
+    catch (const std::runtime_error &)
+    {
+        thrown = true;
+    }
+    ASSERT_TRUE(thrown);
+}
+
+TEST(Serialize, RecordLog)
+{
+    std::string path = "/tmp/serialize_test_" + std::to_string(getpid()) + ".log";
+    unlink(path.c_str());
+
+    {
+        record_log log(path, 100, 4096);
+        out_stream os;
+        for (int i = 0; i < 10000; ++i)
+        {
+            std::string msg = "record " + std::to_string(i);
+            os.reset();
+            os << i << msg;
+            ASSERT_EQ(log.append(os), (uint64_t)i);
+        }
+    }
+
+    //模拟崩溃:子进程提交后直接退出,不写footer
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        record_log log(path, 100, 4096);
+        if (log.size() != 10000)
+        {
+            _exit(1);
+        }
+
+        for (int i = 10000; i < 10250; ++i)
+        {
+            std::string msg = "record " + std::to_string(i);
+            log.append(msg.data(), msg.size());
+        }
+
+        log.commit();
+        _exit(0);
+    }
+
+    int status = -1;
+    waitpid(pid, &status, 0);
+    ASSERT_EQ(status, 0);
+
+    //再追加半条记录
+    FILE *fp = fopen(path.c_str(), "ab");
+    fwrite("\x40\0\0\0\1torn", 1, 9, fp);
+    fclose(fp);
+
+    record_log log(path, 100, 4096);
+    ASSERT_EQ(log.size(), 10250u);
+
+    std::string out;
+    ASSERT_TRUE(log.read(4321, out));
+    int n = 0;
+    std::string msg;
+    in_stream is(out);
+    is >> n >> msg;
+    ASSERT_EQ(n, 4321);
+    ASSERT_EQ(msg, "record 4321");
+
+    ASSERT_TRUE(log.read(10249, out));
+    ASSERT_EQ(out, "record 10249");
+    ASSERT_TRUE(!log.read(10250, out));
+
+    ASSERT_EQ(log.append("next", 4), 10250u);
+    ASSERT_TRUE(log.read(10250, out));
+    ASSERT_EQ(out, "next");
+
+    log.close();
+
+    //索引损坏且中间的记录损坏时报错,不能截掉后面的记录
+    uint64_t zero = 0;
+    unsigned char flip = 0xff;
+    fp = fopen(path.c_str(), "r+b");
+    fseek(fp, 8, SEEK_SET);
+    fwrite(&zero, sizeof(zero), 1, fp);
+    fseek(fp, 24 + 9, SEEK_SET);
+    fwrite(&flip, 1, 1, fp);
+    fclose(fp);
+
+    struct stat before;
+    stat(path.c_str(), &before);
+    bool thrown = false;
+    try
+    {
+        record_log broken(path, 100, 4096);
+    }
+    catch (const std::runtime_error &)
+    {
+        thrown = true;
+    }
+
+    struct stat after;
+    stat(path.c_str(), &after);
+    ASSERT_TRUE(thrown);
+    ASSERT_EQ(after.st_size, before.st_size);
+    unlink(path.c_str());
+
+    //最后一次提交之后没落盘的部分可能是全0或者垃圾数据,重新打开时截掉
+    std::string tails[2];
+    tails[0].assign(4096, '\0');
+    tails[1].assign("\x10\0\0\0\1xxxx", 9);
+    tails[1].append(4087, 'g');
+    for (const std::string &tail : tails)
+    {
+        pid = fork();
+        if (pid == 0)
+        {
+            record_log crashed(path);
+            for (int i = 0; i < 10; ++i)
+            {
+                crashed.append("data", 4);
+            }
+
+            crashed.commit();
+            _exit(0);
+        }
+
+        waitpid(pid, &status, 0);
+        ASSERT_EQ(status, 0);
+        fp = fopen(path.c_str(), "ab");
+        fwrite(tail.data(), 1, tail.size(), fp);
+        fclose(fp);
+
+        record_log reopened(path);
+        ASSERT_EQ(reopened.size(), 10u);
+        ASSERT_EQ(reopened.append("more", 4), 10u);
+        reopened.close();
+        unlink(path.c_str());
+    }
+}
+
+TEST(Serialize, GatherOutput)
+{
+    int id = 7;
+    std::string small = "small";
+    std::string blob(20000, 'b');
+    std::vector<char> bytes(10000, 'c');
+
+    out_stream plain;
+    plain << id << small << blob << bytes;
+
+    out_stream os;
+    os.set_reference_threshold(4096);
+    os << id << small << blob << bytes;
+
+    //大块数据只被引用,没有拷贝
+    ASSERT_LT(os.buffer().size(), 64u);
+    ASSERT_EQ(os.size(), plain.size());
+    ASSERT_TRUE(os.str() == plain.str());
+
+    std::vector<std::pair<const char *, size_t> > segments;
+    os.gather(segments);
+    ASSERT_EQ(segments.size(), 4u);
+    ASSERT_TRUE(segments[1].first == blob.data());
+    ASSERT_TRUE(segments[3].first == bytes.data());
+
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    ASSERT_EQ(gather_write(fds[1], os), plain.size());
+    close(fds[1]);
+
+    std::string received;
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fds[0], buf, sizeof(buf))) > 0)
+    {
+        received.append(buf, n);
+    }
+    close(fds[0]);
+
+    int id1 = 0;
+    std::string small1, blob1;
+    std::vector<char> bytes1;
+    in_stream is(received);
+    is >> id1 >> small1 >> blob1 >> bytes1;
+    ASSERT_EQ(id, id1);
+    ASSERT_EQ(small, small1);
+    ASSERT_TRUE(blob == blob1);
+    ASSERT_TRUE(bytes == bytes1);
+}
+
+TEST(Serialize, GatherSinks)
+{
+    int id = 9;
+    std::string blob(10000, 'b');
+
+    out_stream os;
+    os.set_reference_threshold(4096);
+    os << id << blob;
+    ASSERT_TRUE(os.has_references());
+
+    //引用的数据块也要写进日志和共享内存环
+    std::string path = "/tmp/serialize_sink_" + std::to_string(getpid()) + ".log";
+    unlink(path.c_str());
+    {
+        record_log log(path);
+        ASSERT_EQ(log.append(os), 0u);
+
+        std::string out;
+        ASSERT_TRUE(log.read(0, out));
+        ASSERT_TRUE(out == os.str());
+    }
+    unlink(path.c_str());
+
+    shm_ring ring("/serialize_sink_" + std::to_string(getpid()), 16384, 2);
+    ring.push(os);
+
+    int id1 = 0;
+    std::string blob1;
+    const char *data = nullptr;
+    size_t size = 0;
+    ring.front(data, size);
+    ASSERT_EQ(size, os.size());
+    in_stream is(data, size);
+    is >> id1 >> blob1;
+    ring.pop();
+    ASSERT_EQ(id1, id);
+    ASSERT_TRUE(blob1 == blob);
+}
+
+TEST(Serialize, ConcurrentLog)
+{
+    const int threads = 4;
+    const int count = 50000;
+    concurrent_log log;
+    std::atomic<int> running(threads);
+
+    std::vector<std::thread> producers;
+    for (int t = 0; t < threads; ++t)
+    {
+        producers.emplace_back([&log, &running, t, count]() {
+            concurrent_log::writer writer(log);
+            int id = t;
+            std::string text = "event";
+            for (int i = 0; i < count; ++i)
+            {
+                writer.emit(id, i, text);
+            }
+            --running;
+        });
+    }
+
+    std::string out;
+    size_t records = 0;
+    while (running > 0 || records < (size_t)threads * count)
+    {
+        records += log.drain(out, 1024);
+    }
+
+    for (auto &producer : producers)
+    {
+        producer.join();
+    }
+
+    ASSERT_EQ(records, (size_t)threads * count);
+
+    std::vector<int> next(threads, 0);
+    in_stream is(out);
+    for (size_t r = 0; r < records; ++r)
+    {
+        unsigned int len = 0;
+        int id = -1, seq = -1;
+        std::string text;
+        is >> len >> id >> seq >> text;
+        ASSERT_EQ(len, sizeof(int) * 2 + sizeof(unsigned int) + 5);
+        ASSERT_EQ(seq, next[id]++);
+        ASSERT_EQ(text, "event");
+    }
+
+    ASSERT_EQ(is.size(), out.size());
+
+    //编码失败的记录不发布,节点留给下一条记录
+    struct broken : public Serializable
+    {
+        virtual std::string serialize()
+        {
+            throw std::runtime_error("broken");
+        }
+
+        virtual unsigned int deserialize(const std::string &)
+        {
+            return 0;
+        }
+    };
+
+    broken bad;
+    int value = 11;
+    concurrent_log::writer writer(log);
+    bool thrown = false;
+    try
+    {
+        writer.emit(value, bad);
+    }
+    catch (const std::runtime_error &)
+    {
+        thrown = true;
+    }
+    ASSERT_TRUE(thrown);
+
+    writer.emit(value);
+    out.clear();
+    ASSERT_EQ(log.drain(out), 1u);
+    ASSERT_EQ(out.size(), 2 * sizeof(unsigned int));
+}
+
+TEST(Serialize, LargeLengths)
+{
+    std::string text(3000, 'x');
+    std::vector<int> nums(1000);
+    for (size_t i = 0; i < nums.size(); ++i)
+    {
+        nums[i] = (int)i;
+    }
+    std::list<std::string> names = {"a", "bc"};
+
+    out_stream os;
+    os.set_length_mode(length_varint);
+    os.set_chunk_size(1024);
+    os << text << nums << names;
+
+    //分段写出,解码端按一个字符串读取
+    os.write_chunk("hello ", 6);
+    os.write_chunk("world", 5);
+    os.end_chunks();
+    os.write_chunk("abc", 3);
+    os.end_chunks();
+
+    std::string text2;
+    std::vector<int> nums2;
+    std::list<std::string> names2;
+    std::string joined;
+    std::vector<char> bytes;
+    in_stream is(os.str());
+    is.set_length_mode(length_varint);
+    is >> text2 >> nums2 >> names2 >> joined >> bytes;
+    ASSERT_EQ(text2, text);
+    ASSERT_TRUE(nums2 == nums);
+    ASSERT_TRUE(names2 == names);
+    ASSERT_EQ(joined, "hello world");
+    ASSERT_EQ(bytes.size(), (size_t)3);
+    ASSERT_EQ(is.size(), os.size());
+
+    //逐块解码,数据分多次到达
+    std::map<int, std::string> themap;
+    themap[1] = "one";
+    themap[2] = text;
+    std::set<int> theset(nums.begin(), nums.end());
+    std::unordered_map<int, std::string> hashed(themap.begin(), themap.end());
+    os << themap << theset << hashed;
+    std::string codestr = os.str();
+
+    std::string fedtext, fedjoined;
+    std::vector<int> fednums;
+    std::list<std::string> fednames;
+    std::vector<char> fedbytes;
+    std::map<int, std::string> fedmap;
+    std::set<int> fedset;
+    std::unordered_map<int, std::string> fedhashed;
+    resumable_in_stream fed;
+    fed.set_length_mode(length_varint);
+    fed >> fedtext >> fednums >> fednames >> fedjoined >> fedbytes >> fedmap >> fedset >> fedhashed;
+    for (size_t pos = 0; pos < codestr.size(); pos += 5)
+    {
+        fed.feed(codestr.data() + pos, std::min<size_t>(5, codestr.size() - pos));
+    }
+
+    ASSERT_TRUE(fed.done());
+    ASSERT_EQ(fed.size(), codestr.size());
+    ASSERT_TRUE(fedtext == text);
+    ASSERT_TRUE(fednums == nums);
+    ASSERT_TRUE(fednames == names);
+    ASSERT_EQ(fedjoined, "hello world");
+    ASSERT_EQ(fedbytes.size(), (size_t)3);
+    ASSERT_TRUE(fedmap == themap);
+    ASSERT_TRUE(fedset == theset);
+    ASSERT_TRUE(fedhashed == hashed);
+
+    //默认的4字节长度不接受分段写出
+    out_stream fixed;
+    bool thrown = false;
+    try
+    {
+        fixed.write_chunk("abc", 3);
+    }
+    catch (const std::logic_error &)
+    {
+        thrown = true;
+    }
+    ASSERT_TRUE(thrown);
+}
+
 int main(int argc, char *argv[])
 {
     return ::lut::RunAllTests();